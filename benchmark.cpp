@@ -0,0 +1,308 @@
+/*
+  Chameleon, a UCI chinese chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2017 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+  Copyright (C) 2017 Wilbert Lee
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <istream>
+#include <thread>
+#include <vector>
+
+#include "epd.h"
+#include "misc.h"
+#include "packed.h"
+#include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "uci.h"
+
+using namespace std;
+
+namespace
+{
+	const vector<string> Defaults =
+	{
+		"rnbakabnr/9/1c5c1/p1p1p1p1p/9/9/P1P1P1P1P/1C5C1/9/RNBAKABNR w - - 0 1",
+		"rn1akabnr/9/c3b4/p1p1p1p1p/8c/8C/P1P1P1P1P/1C2B4/9/RN1AKABNR w - - 12 7",
+		"3akabnr/3R5/4b4/p1p1p1p1p/8c/8C/PrP1P1P1P/1c2B4/9/R1CAKABN1 w - - 2 13",
+		"3akabr1/9/4b3n/C3p3C/3Rc4/9/P3r1P1P/1c2B3N/9/R2AKAB2 w - - 0 19",
+		"C2R1abr1/4k4/4ba2n/4p4/9/9/P5P1P/4r3C/4A4/R2K1A3 w - - 0 25",
+		"C3k3C/8R/4ba2b/4p4/2rr5/9/P5P1P/9/4A4/R2K1A3 w - - 9 31",
+		"1nbakabnr/9/7r1/p1p1p1pcp/6c2/6C2/P1P1P1P1P/4C2R1/9/RNBAKABN1 w - - 12 7",
+		"1nbakabnr/9/7r1/2p1p3p/p5Cc1/9/P1P1P1P1P/4B2R1/9/RN1AKABN1 w - - 0 13",
+		"3akabn1/3n5/4b2r1/2p1p3p/p5rc1/6C2/P1P1P1PRP/4B1N2/9/RN1AKAB2 w - - 12 19",
+		"3akabn1/3n5/4b4/2p1p2rp/p6c1/2C3r2/P1P1P1P1P/1N2B1N2/9/1R1AKAB2 w - - 0 25",
+		"3akab2/3R5/4b4/2p1p3p/p6n1/1C4P2/P1P1P3P/1N2B1rc1/9/3AKAB2 w - - 0 31",
+		"rn1aka1nr/9/b7b/p1p1p1p1p/c8/9/P1P1P1P1P/4B3C/9/RN1AKABNR w - - 2 7",
+		"r1baka1nr/3n5/9/pRp1p1p1p/6b2/PN4P2/2c1P3P/4B3C/9/3AKABNR w - - 0 13",
+		"3aka1nr/9/n3b4/N1p1pCP1p/8c/P8/4P4/4B4/9/3AKABNR w - - 3 19",
+		"3aka1n1/8r/5P3/C7p/2b1p3c/P8/4P4/4B4/9/3AKABNR w - - 7 25",
+		"3aka3/9/4b1n2/8p/9/P3P4/6r2/4B3C/7R1/3AKAB2 w - - 8 37"
+	};
+} // namespace
+
+// benchmark() runs a simple benchmark by letting the engine analyze a set
+// of positions for a given limit each. There are five parameters: the
+// transposition table size, the number of search threads that should
+// be used, the limit value spent for each position (optional, default is
+// depth 10), an optional file name where to look for positions in FEN or
+// EPD format, or in packed format when its name ends with ".bin" (defaults
+// are the positions defined above) and the type of the limit value: depth
+// (default), time in millisecs, number of nodes or perft.
+void benchmark(const Position& current, istream& is)
+{
+	string token;
+	vector<PackedPosition> positions;
+	Search::LimitsType limits;
+
+	// Assign default values to missing arguments
+	string ttSize = (is >> token) ? token : "16";
+	string threads = (is >> token) ? token : "1";
+	string limit = (is >> token) ? token : "10";
+	string fenFile = (is >> token) ? token : "default";
+	string limitType = (is >> token) ? token : "depth";
+
+	Options["Hash"] = ttSize;
+	Options["Threads"] = threads;
+	Search::clear();
+
+	if (limitType == "time")
+		limits.movetime = stoi(limit); // movetime is in millisecs
+
+	else if (limitType == "nodes")
+		limits.nodes = stoi(limit);
+
+	else if (limitType == "mate")
+		limits.mate = stoi(limit);
+
+	else
+		limits.depth = stoi(limit);
+
+	if (fenFile == "default")
+		for (const string& fen : Defaults)
+			positions.push_back(Position(fen, false, Threads.main()).packed());
+
+	else if (fenFile == "current")
+		positions.push_back(current.packed());
+
+	else if (fenFile.size() > 4 && fenFile.substr(fenFile.size() - 4) == ".bin")
+	{
+		PackedPosition pp;
+		PackedReader file(fenFile);
+
+		if (!file.is_open())
+		{
+			cerr << "Unable to open file " << fenFile
+				<< " as packed positions of version " << int(PackedVersion) << endl;
+			return;
+		}
+
+		while (file.read(pp))
+			positions.push_back(pp);
+	}
+
+	else
+	{
+		EpdRecord rec;
+		EpdReader file(fenFile);
+
+		if (!file.is_open())
+		{
+			cerr << "Unable to open file " << fenFile << endl;
+			return;
+		}
+
+		while (file.next(rec))
+			positions.push_back(rec.packed);
+	}
+
+	uint64_t nodes = 0;
+	TimePoint elapsed = now();
+
+	for (size_t i = 0; i < positions.size(); ++i)
+	{
+		Position pos(positions[i], Threads.main());
+
+		cerr << "\nPosition: " << i + 1 << '/' << positions.size() << endl;
+
+		if (limitType == "perft")
+			nodes += Search::perft(pos, limits.depth * ONE_PLY);
+
+		else
+		{
+			limits.startTime = now();
+			Threads.start_thinking(pos, limits);
+			Threads.main()->wait_for_search_finished();
+			nodes += Threads.nodes_searched();
+		}
+	}
+
+	elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+
+	dbg_print(); // Just before exiting
+
+	cerr << "\n==========================="
+		<< "\nTotal time (ms) : " << elapsed
+		<< "\nNodes searched  : " << nodes
+		<< "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+}
+
+// codec_benchmark() measures the throughput of the FEN and of the packed
+// position formats, decoding and encoding back the benchmark positions (or
+// those of the given FEN file) the given number of times, and of the EPD
+// scanner loading the same positions from memory.
+void codec_benchmark(istream& is)
+{
+	string token;
+	vector<string> fens;
+
+	string passes = (is >> token) ? token : "100000";
+	string fenFile = (is >> token) ? token : "default";
+
+	if (fenFile == "default")
+		fens = Defaults;
+
+	else
+	{
+		string fen;
+		ifstream file(fenFile);
+
+		if (!file.is_open())
+		{
+			cerr << "Unable to open file " << fenFile << endl;
+			return;
+		}
+
+		while (getline(file, fen))
+			if (!fen.empty())
+				fens.push_back(fen);
+	}
+
+	vector<PackedPosition> packs;
+	string text;
+	EpdRecord rec;
+	Position pos;
+	uint64_t cnt = uint64_t(stoi(passes)) * fens.size(), check = 0;
+
+	for (const string& fen : fens)
+	{
+		packs.push_back(Position(fen, false, Threads.main()).packed());
+		text += fen + '\n';
+	}
+
+	TimePoint elapsed = now();
+
+	for (int i = 0; i < stoi(passes); ++i)
+		for (const string& fen : fens)
+		{
+			pos.set(fen, false, Threads.main());
+			check += pos.fen().size();
+		}
+
+	TimePoint fenTime = now() - elapsed + 1;
+	elapsed = now();
+
+	for (int i = 0; i < stoi(passes); ++i)
+		for (const PackedPosition& pp : packs)
+		{
+			pos.set(pp, Threads.main());
+			check += pos.packed().rule50;
+		}
+
+	TimePoint packedTime = now() - elapsed + 1;
+	elapsed = now();
+
+	for (int i = 0; i < stoi(passes); ++i)
+	{
+		EpdReader reader(text.data(), text.size());
+
+		while (reader.next(pos, rec, Threads.main()))
+			check += pos.rule50_count();
+	}
+
+	TimePoint scanTime = now() - elapsed + 1;
+
+	cerr << "\n==========================="
+		<< "\nPositions       : " << cnt
+		<< "\nFEN positions/s : " << 1000 * cnt / fenTime
+		<< "\nPacked pos/s    : " << 1000 * cnt / packedTime
+		<< "\nEPD scan pos/s  : " << 1000 * cnt / scanTime
+		<< "\nChecksum        : " << check << endl;
+}
+
+// scaling_benchmark() measures how the search scales with the number of
+// threads: it searches the benchmark positions to a fixed depth with 1, 2, 4
+// and so on threads up to the given maximum (default is all the cores), and
+// reports for each the time to depth, the speedup over 1 thread and the
+// nodes per second. Parameters are the maximum number of threads, the depth
+// (default 12) and the transposition table size (default 256 MB). The parallel
+// search is the one selected by the "YBWC" option, Lazy SMP by default.
+void scaling_benchmark(istream& is)
+{
+	string token;
+	Search::LimitsType limits;
+	size_t cores = std::max(std::thread::hardware_concurrency(), 1U);
+
+	size_t maxThreads = (is >> token) ? stoi(token) : cores;
+	limits.depth = (is >> token) ? stoi(token) : 12;
+	Options["Hash"] = (is >> token) ? token : "256";
+
+	vector<size_t> threadCounts;
+	TimePoint baseTime = 0;
+
+	for (size_t threads = 1; threads < maxThreads; threads *= 2)
+		threadCounts.push_back(threads);
+
+	threadCounts.push_back(maxThreads);
+
+	cerr << "\nParallel search: " << (Options["YBWC"] ? "YBWC" : "Lazy SMP")
+		<< "\nThreads    Time (ms)  Speedup        Nodes       Nodes/s" << endl;
+
+	for (size_t threads : threadCounts)
+	{
+		uint64_t nodes = 0;
+
+		Options["Threads"] = std::to_string(threads);
+		Search::clear();
+
+		TimePoint elapsed = now();
+
+		for (const string& fen : Defaults)
+		{
+			Position pos(fen, false, Threads.main());
+
+			limits.startTime = now();
+			Threads.start_thinking(pos, limits);
+			Threads.main()->wait_for_search_finished();
+			nodes += Threads.nodes_searched();
+		}
+
+		elapsed = now() - elapsed + 1;
+		baseTime = baseTime ? baseTime : elapsed;
+
+		cerr << setw(7) << threads
+			<< setw(13) << elapsed
+			<< setw(9) << int(100.0 * baseTime / elapsed + 0.5) / 100.0
+			<< setw(13) << nodes
+			<< setw(14) << 1000 * nodes / elapsed << endl;
+	}
+}
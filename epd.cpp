@@ -0,0 +1,305 @@
+/*
+  Chameleon, a UCI chinese chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2017 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+  Copyright (C) 2017 Wilbert Lee
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "epd.h"
+
+namespace
+{
+	const char PieceToChar[] = " PABNCRK pabncrk";
+
+	bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+	const char* skip_blanks(const char* p, const char* end)
+	{
+		while (p < end && is_blank(*p))
+			++p;
+
+		return p;
+	}
+
+	const char* skip_word(const char* p, const char* end)
+	{
+		while (p < end && !is_blank(*p))
+			++p;
+
+		return p;
+	}
+
+	// parse_int() reads an unsigned number and returns false if there is none
+	bool parse_int(const char*& p, const char* end, int& n)
+	{
+		const char* start = p;
+
+		for (n = 0; p < end && *p >= '0' && *p <= '9'; ++p)
+			n = 10 * n + *p - '0';
+
+		return p != start && (p == end || is_blank(*p));
+	}
+
+} // namespace
+
+bool EpdRecord::Field::operator==(const char* s) const
+{
+	return size_t(end - begin) == std::strlen(s) && !std::memcmp(begin, s, end - begin);
+}
+
+// EpdRecord::operand() returns the operand of the given opcode, if present
+const EpdRecord::Field* EpdRecord::operand(const char* op) const
+{
+	for (int i = 0; i < opcodeCount; ++i)
+		if (opcode[i] == op)
+			return &operands[i];
+
+	return nullptr;
+}
+
+EpdReader::EpdReader(const std::string& fileName) : data(nullptr), end(nullptr), cur(nullptr), mapped(true)
+{
+#ifdef _WIN32
+	mapHandle = nullptr;
+	fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		fileHandle = nullptr;
+		return;
+	}
+
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx(fileHandle, &size) || !size.QuadPart)
+		return;
+
+	mapHandle = CreateFileMapping(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (!mapHandle)
+		return;
+
+	data = (const char*)MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0);
+	end = data ? data + size.QuadPart : nullptr;
+#else
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	struct stat st;
+
+	if (fd == -1)
+		return;
+
+	if (!fstat(fd, &st) && st.st_size)
+	{
+		void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (p != MAP_FAILED)
+		{
+			madvise(p, st.st_size, MADV_SEQUENTIAL);
+			data = (const char*)p;
+			end = data + st.st_size;
+		}
+	}
+
+	::close(fd);
+#endif
+
+	cur = data;
+}
+
+EpdReader::~EpdReader()
+{
+	if (!mapped)
+		return;
+
+#ifdef _WIN32
+	if (data)
+		UnmapViewOfFile(data);
+
+	if (mapHandle)
+		CloseHandle(mapHandle);
+
+	if (fileHandle)
+		CloseHandle(fileHandle);
+#else
+	if (data)
+		munmap((void*)data, end - data);
+#endif
+}
+
+// EpdReader::next() parses the next valid line of the file into 'rec' and
+// returns false once the end of the file is reached.
+bool EpdReader::next(EpdRecord& rec)
+{
+	while (cur < end)
+	{
+		const char* eol = (const char*)std::memchr(cur, '\n', end - cur);
+		const char* lineBegin = cur;
+
+		if (!eol)
+			eol = end;
+
+		cur = eol + (eol < end);
+
+		if (eol > lineBegin && eol[-1] == '\r')
+			--eol;
+
+		if (parse(lineBegin, eol, rec))
+			return true;
+	}
+
+	return false;
+}
+
+// EpdReader::next() sets up 'pos' from the next valid line of the file
+bool EpdReader::next(Position& pos, EpdRecord& rec, Thread* th)
+{
+	if (!next(rec))
+		return false;
+
+	pos.set(rec.packed, th);
+	return true;
+}
+
+// EpdReader::parse() parses a single line holding a FEN string, or the four
+// position fields of an EPD record followed by its opcodes. Castling and en
+// passant fields are skipped, when present, as in Position::set().
+bool EpdReader::parse(const char* p, const char* end, EpdRecord& rec)
+{
+	Piece board[SQUARE_NB] = {};
+	int sq = SQ_A9, rule50 = 0, fullMove = 1;
+	int n = 0, kings[COLOR_NB] = {};
+
+	p = skip_blanks(p, end);
+	rec.fen.begin = p;
+	rec.packed = PackedPosition();
+	rec.opcodeCount = 0;
+
+	// 1. Piece placement
+	for (; p < end && !is_blank(*p); ++p)
+	{
+		const char* pc;
+
+		if (*p >= '1' && *p <= '9')
+			sq += *p - '0';
+
+		else if (*p == '/')
+			sq -= 18;
+
+		else if (*p && (pc = std::strchr(PieceToChar, *p)) != nullptr)
+		{
+			Piece piece = Piece(pc - PieceToChar);
+
+			if (sq < 0 || sq >= SQUARE_NB || n++ == 32 || type_of(piece) == NO_PIECE_TYPE)
+				return false;
+
+			board[sq++] = piece;
+			kings[color_of(piece)] += type_of(piece) == KING;
+		}
+		else
+			return false;
+	}
+
+	if (kings[WHITE] != 1 || kings[BLACK] != 1)
+		return false;
+
+	// 2. Active color
+	p = skip_blanks(p, end);
+
+	if (p == end || (*p != 'w' && *p != 'b'))
+		return false;
+
+	Color us = *p == 'w' ? WHITE : BLACK;
+	p = skip_blanks(skip_word(p, end), end);
+
+	// 3-4. Castling and en passant fields, unused in xiangqi
+	for (int i = 0; i < 2 && p < end && *p == '-'; ++i)
+		p = skip_blanks(skip_word(p, end), end);
+
+	// 5-6. Halfmove clock and fullmove number, not present in EPD records
+	const char* q = p;
+
+	if (parse_int(q, end, rule50))
+	{
+		p = skip_blanks(q, end);
+
+		if (parse_int(q = p, end, fullMove))
+			p = skip_blanks(q, end);
+	}
+
+	rec.fen.end = p;
+
+	while (rec.fen.end > rec.fen.begin && is_blank(rec.fen.end[-1]))
+		--rec.fen.end;
+
+	// EPD opcodes: "opcode operand...;" where quoted operands may hold ';'
+	while (p < end && rec.opcodeCount < EpdRecord::MaxOpcodes)
+	{
+		EpdRecord::Field& op = rec.opcode[rec.opcodeCount];
+		EpdRecord::Field& operand = rec.operands[rec.opcodeCount];
+
+		op.begin = p;
+		op.end = p = std::find(p, skip_word(p, end), ';');
+		operand.begin = p = skip_blanks(p, end);
+
+		for (bool quoted = false; p < end && (quoted || *p != ';'); ++p)
+			quoted ^= *p == '"';
+
+		operand.end = p;
+
+		while (operand.end > operand.begin && is_blank(operand.end[-1]))
+			--operand.end;
+
+		if (operand.end - operand.begin >= 2 && *operand.begin == '"' && operand.end[-1] == '"')
+			++operand.begin, --operand.end;
+
+		if (op.end > op.begin)
+			++rec.opcodeCount;
+
+		p = skip_blanks(p + (p < end), end);
+	}
+
+	// Pack the position, visiting the squares in FEN order
+	n = 0;
+
+	for (int i = 0; i < SQUARE_NB; ++i)
+		if (board[VerticalFlip[i]] != NO_PIECE)
+		{
+			rec.packed.occupied[i / 8] |= uint8_t(1 << (i % 8));
+			rec.packed.pieces[n / 2] |= uint8_t(board[VerticalFlip[i]] << (4 * (n % 2)));
+			++n;
+		}
+
+	rec.packed.occupied[11] |= uint8_t(us == BLACK ? 0x80 : 0);
+	rec.packed.rule50 = uint16_t(rule50);
+	rec.packed.gamePly = uint16_t(std::max(2 * (fullMove - 1), 0) + (us == BLACK));
+
+	return true;
+}
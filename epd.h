@@ -0,0 +1,83 @@
+/*
+  Chameleon, a UCI chinese chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2017 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+  Copyright (C) 2017 Wilbert Lee
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef EPD_H_INCLUDED
+#define EPD_H_INCLUDED
+
+#include <string>
+
+#include "position.h"
+
+// EpdRecord is one line of a FEN or EPD file as returned by EpdReader. Its
+// fields point into the mapped file and stay valid as long as the reader.
+struct EpdRecord
+{
+	struct Field
+	{
+		std::string str() const { return std::string(begin, end); }
+		bool operator==(const char* s) const;
+
+		const char* begin;
+		const char* end;
+	};
+
+	static const int MaxOpcodes = 16;
+
+	const Field* operand(const char* opcode) const;
+
+	PackedPosition packed;
+	Field fen; // Text of the position fields
+	Field opcode[MaxOpcodes];
+	Field operands[MaxOpcodes];
+	int opcodeCount;
+};
+
+// EpdReader maps a whole FEN or EPD file in memory and parses it line by line
+// in place, with no stream and no allocation, so that suites of millions of
+// positions load at close to memory speed. Lines that cannot be parsed are
+// skipped.
+class EpdReader
+{
+public:
+	explicit EpdReader(const std::string& fileName);
+	EpdReader(const char* buf, size_t size) : data(buf), end(buf + size), cur(buf), mapped(false) {}
+	EpdReader(const EpdReader&) = delete;
+	~EpdReader();
+
+	bool is_open() const { return data != nullptr; }
+	bool next(EpdRecord& rec);
+	bool next(Position& pos, EpdRecord& rec, Thread* th);
+
+	static bool parse(const char* begin, const char* end, EpdRecord& rec);
+
+private:
+	const char* data;
+	const char* end;
+	const char* cur;
+	bool mapped;
+#ifdef _WIN32
+	void* fileHandle;
+	void* mapHandle;
+#endif
+};
+
+#endif // #ifndef EPD_H_INCLUDED
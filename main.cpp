@@ -24,6 +24,7 @@
 
 #include "bitboard.h"
 #include "evaluate.h"
+#include "numa.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -39,6 +40,7 @@ int main(int argc, char* argv[])
 	Search::init();
 	Eval::init();
 	Pawns::init();
+	Numa::init();
 	Threads.init();
 	TT.init();
 	UCI::loop(argc, argv);
@@ -52,6 +52,25 @@ inline TimePoint now()
 		(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+// mul_hi64() returns the high 64 bits of the product a * b. Used to map a key
+// uniformly onto [0, b) for any b, not only for powers of 2.
+inline uint64_t mul_hi64(uint64_t a, uint64_t b)
+{
+#if defined(_WIN64) && defined(_MSC_VER)
+	return __umulh(a, b);
+#elif defined(__GNUC__) && defined(__SIZEOF_INT128__)
+	__extension__ typedef unsigned __int128 uint128;
+	return uint64_t(((uint128)a * (uint128)b) >> 64);
+#else
+	uint64_t aL = uint32_t(a), aH = a >> 32;
+	uint64_t bL = uint32_t(b), bH = b >> 32;
+	uint64_t c1 = (aL * bL) >> 32;
+	uint64_t c2 = aH * bL + c1;
+	uint64_t c3 = aL * bH + uint32_t(c2);
+	return aH * bH + (c2 >> 32) + (c3 >> 32);
+#endif
+}
+
 template<class Entry, int Size>
 struct HashTable
 {
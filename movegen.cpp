@@ -80,9 +80,9 @@ static ExtMove* gen_rook_moves(const Position& pos, ExtMove* moveList)
 {
 	Color us = pos.side_to_move();
 	Bitboard target = ~pos.pieces(us);
-	const Square* pl = pos.squares<ROOK>(us);
+	const uint8_t* pl = pos.squares<ROOK>(us);
 
-	for (Square from = *pl; from != SQ_NONE; from = *++pl)
+	for (Square from = Square(*pl); from != SQ_NONE; from = Square(*++pl))
 	{
 		Bitboard att = pos.attacks_from<ROOK>(from)&target;
 
@@ -95,9 +95,9 @@ static ExtMove* gen_knight_moves(const Position& pos, ExtMove* moveList)
 {
 	Color us = pos.side_to_move();
 	Bitboard target = ~pos.pieces(us);
-	const Square* pl = pos.squares<KNIGHT>(us);
+	const uint8_t* pl = pos.squares<KNIGHT>(us);
 
-	for (Square from = *pl; from != SQ_NONE; from = *++pl)
+	for (Square from = Square(*pl); from != SQ_NONE; from = Square(*++pl))
 	{
 		Bitboard att = pos.attacks_from<KNIGHT>(from)&target;
 
@@ -111,9 +111,9 @@ static ExtMove* gen_cannon_moves(const Position& pos, ExtMove* moveList)
 	Color us = pos.side_to_move();
 	Bitboard target = pos.pieces(~us);
 	Bitboard empty = ~pos.pieces();
-	const Square* pl = pos.squares<CANNON>(us);
+	const uint8_t* pl = pos.squares<CANNON>(us);
 
-	for (Square from = *pl; from != SQ_NONE; from = *++pl)
+	for (Square from = Square(*pl); from != SQ_NONE; from = Square(*++pl))
 	{
 		Bitboard att = pos.attacks_from<CANNON>(from)&target;
 
@@ -168,9 +168,9 @@ static ExtMove* gen_bishop_moves(const Position& pos, ExtMove* moveList)
 {
 	Color us = pos.side_to_move();
 	Bitboard target = ~pos.pieces(us);
-	const Square* pl = pos.squares<BISHOP>(us);
+	const uint8_t* pl = pos.squares<BISHOP>(us);
 
-	for (Square from = *pl; from != SQ_NONE; from = *++pl)
+	for (Square from = Square(*pl); from != SQ_NONE; from = Square(*++pl))
 	{
 		Bitboard att = pos.attacks_from<BISHOP>(from)&target;
 		SERIALIZE(att);
@@ -182,9 +182,9 @@ static ExtMove* gen_advisor_moves(const Position& pos, ExtMove* moveList)
 {
 	Color us = pos.side_to_move();
 	Bitboard target = ~pos.pieces(us);
-	const Square* pl = pos.squares<ADVISOR>(us);
+	const uint8_t* pl = pos.squares<ADVISOR>(us);
 
-	for (Square from = *pl; from != SQ_NONE; from = *++pl)
+	for (Square from = Square(*pl); from != SQ_NONE; from = Square(*++pl))
 	{
 		Bitboard att = pos.attacks_from<ADVISOR>(from)&target;
 		SERIALIZE(att);
@@ -196,9 +196,9 @@ static ExtMove* gen_king_moves(const Position& pos, ExtMove* moveList)
 {
 	Color us = pos.side_to_move();
 	Bitboard target = ~pos.pieces(us);
-	const Square* pl = pos.squares<KING>(us);
+	const uint8_t* pl = pos.squares<KING>(us);
 
-	for (Square from = *pl; from != SQ_NONE; from = *++pl)
+	for (Square from = Square(*pl); from != SQ_NONE; from = Square(*++pl))
 	{
 		Bitboard att = pos.attacks_from<KING>(from)&target;
 		SERIALIZE(att);
@@ -382,9 +382,9 @@ ExtMove* generate_moves(const Position& pos, ExtMove* moveList,
 
 	Bitboard empty = ~pos.pieces();
 
-	const Square* pl = pos.squares<Pt>(us);
+	const uint8_t* pl = pos.squares<Pt>(us);
 
-	for (Square from = *pl; from != SQ_NONE; from = *++pl)
+	for (Square from = Square(*pl); from != SQ_NONE; from = Square(*++pl))
 	{
 
 		if (from == exclued)	continue;
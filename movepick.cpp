@@ -297,4 +297,28 @@ Move MovePicker::next_move()
 			assert(false);
 		}
 	}
-}
\ No newline at end of file
+}
+
+#ifdef USE_PREFETCH_AHEAD
+
+// MovePicker::peek() returns the move that next_move() should return next,
+// without moving on, or MOVE_NONE at the end of the current stage. It is only
+// a hint for prefetching: the move may still be skipped by next_move(), e.g.
+// as a losing capture or a duplicate of the TT move or of a killer.
+Move MovePicker::peek() const
+{
+	switch (stage)
+	{
+	case GOOD_CAPTURES: case ALL_EVASIONS: case QCAPTURES_1: case QCAPTURES_2:
+	case PROBCUT_CAPTURES: case RECAPTURES:
+		return cur < endMoves ? Move(*std::max_element(cur, endMoves)) : MOVE_NONE;
+	case GOOD_QUIETS: case BAD_QUIETS: case CHECKS:
+		return cur < endMoves ? Move(*cur) : MOVE_NONE;
+	case BAD_CAPTURES:
+		return cur > endMoves ? Move(*cur) : MOVE_NONE;
+	default:
+		return MOVE_NONE;
+	}
+}
+
+#endif
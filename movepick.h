@@ -89,6 +89,9 @@ public:
 	MovePicker(const Position&, Move, Depth, const HistoryStats&, const CounterMovesStats&, Move, Search::Stack*);
 
 	Move next_move();
+#ifdef USE_PREFETCH_AHEAD
+	Move peek() const;
+#endif
 
 private:
 	template<GenType> void score();
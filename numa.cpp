@@ -0,0 +1,147 @@
+/*
+  Chameleon, a UCI chinese chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2017 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+  Copyright (C) 2017 Wilbert Lee
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#include "numa.h"
+
+namespace
+{
+	// The IDs of the online nodes, which need not be contiguous, and the CPUs of
+	// each, as listed in /sys/devices/system/node/nodeN/cpulist
+	std::vector<int> NodeIds;
+	std::vector<std::vector<int>> NodeCpus;
+
+	// parse_list() turns a kernel list like "0-7,16-23" into the numbers listed
+	std::vector<int> parse_list(const std::string& list)
+	{
+		std::vector<int> cpus;
+		size_t pos = 0;
+
+		while (pos < list.size())
+		{
+			size_t end = list.find(',', pos);
+			std::string range = list.substr(pos, end - pos);
+			size_t dash = range.find('-');
+
+			if (!range.empty())
+			{
+				int first = std::stoi(range);
+				int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+
+				for (int c = first; c <= last; ++c)
+					cpus.push_back(c);
+			}
+
+			pos = end == std::string::npos ? list.size() : end + 1;
+		}
+
+		return cpus;
+	}
+
+} // namespace
+
+// Numa::init() reads the online nodes and the CPUs of each, skipping the nodes
+// without CPUs
+void Numa::init()
+{
+#if defined(__linux__)
+	std::string online;
+	std::ifstream file("/sys/devices/system/node/online");
+
+	if (!std::getline(file, online))
+		return;
+
+	for (int n : parse_list(online))
+	{
+		std::string list;
+		std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+
+		if (std::getline(cpulist, list) && !parse_list(list).empty())
+		{
+			NodeIds.push_back(n);
+			NodeCpus.push_back(parse_list(list));
+		}
+	}
+#endif
+}
+
+// Numa::info() describes the topology found and its use. It is reported when
+// the threads or the hash are set up, and by "tt stats".
+std::string Numa::info()
+{
+	if (NodeCpus.size() < 2)
+		return "NUMA nodes 1, no thread binding";
+
+	return "NUMA nodes " + std::to_string(NodeCpus.size())
+		+ ", threads bound round-robin, hash interleaved";
+}
+
+// Numa::bind_this_thread() binds the calling search thread to all the CPUs of
+// node 'idx' modulo the number of nodes, leaving the OS free to schedule the
+// thread inside its node.
+void Numa::bind_this_thread(size_t idx)
+{
+#if defined(__linux__)
+	if (NodeCpus.size() < 2)
+		return;
+
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+
+	for (int c : NodeCpus[idx % NodeCpus.size()])
+		if (c < CPU_SETSIZE)
+			CPU_SET(c, &mask);
+
+	sched_setaffinity(0, sizeof(cpu_set_t), &mask);
+#endif
+}
+
+// Numa::interleave() sets the memory policy of a still untouched mapping so
+// that its pages get allocated round-robin on all nodes. It uses the mbind
+// system call directly, to avoid a dependency on libnuma.
+void Numa::interleave(void* mem, size_t size)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	const int MPOL_INTERLEAVE = 3;
+	const size_t Bits = 8 * sizeof(unsigned long);
+
+	if (NodeIds.size() < 2)
+		return;
+
+	std::vector<unsigned long> nodeMask(NodeIds.back() / Bits + 1);
+
+	for (int n : NodeIds)
+		nodeMask[n / Bits] |= 1UL << (n % Bits);
+
+	// The kernel reads maxnode - 1 bits, so pass one more than the mask holds
+	syscall(SYS_mbind, mem, size, MPOL_INTERLEAVE, nodeMask.data(), nodeMask.size() * Bits + 1, 0);
+#endif
+}
@@ -0,0 +1,43 @@
+/*
+  Chameleon, a UCI chinese chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2017 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+  Copyright (C) 2017 Wilbert Lee
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef NUMA_H_INCLUDED
+#define NUMA_H_INCLUDED
+
+#include <cstddef>
+#include <string>
+
+// The Numa namespace reads the NUMA topology of the machine straight from
+// /sys/devices/system/node on Linux. On machines with more than one node the
+// search threads are bound round-robin across the nodes and the memory of the
+// transposition table is interleaved page by page between them, so that all
+// threads see the same average latency instead of half of them probing remote
+// memory. Elsewhere, or on single node machines, nothing is changed.
+namespace Numa
+{
+	void init();
+	std::string info();
+	void bind_this_thread(size_t idx);
+	void interleave(void* mem, size_t size);
+}
+
+#endif // #ifndef NUMA_H_INCLUDED
@@ -0,0 +1,93 @@
+/*
+  Chameleon, a UCI chinese chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2017 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+  Copyright (C) 2017 Wilbert Lee
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <cstring>
+
+#include "packed.h"
+
+namespace
+{
+	const char Magic[4] = { 'C', 'H', 'P', 'K' };
+
+	static_assert(sizeof(Magic) + 1 <= sizeof(PackedPosition), "Header does not fit a record");
+} // namespace
+
+PackedWriter::PackedWriter(const std::string& fileName, size_t blockSize)
+	: file(fileName, std::ios::out | std::ios::binary), buffer(blockSize), size(0)
+{
+	char header[sizeof(PackedPosition)] = {};
+
+	std::memcpy(header, Magic, sizeof(Magic));
+	header[sizeof(Magic)] = char(PackedVersion);
+	file.write(header, sizeof(header));
+}
+
+void PackedWriter::write(const PackedPosition& pp)
+{
+	buffer[size++] = pp;
+
+	if (size == buffer.size())
+		flush();
+}
+
+void PackedWriter::flush()
+{
+	if (size)
+		file.write(reinterpret_cast<const char*>(buffer.data()), size * sizeof(PackedPosition));
+
+	size = 0;
+	file.flush();
+}
+
+PackedReader::PackedReader(const std::string& fileName, size_t blockSize)
+	: file(fileName, std::ios::in | std::ios::binary), buffer(blockSize), cur(0), size(0)
+{
+	char header[sizeof(PackedPosition)];
+
+	if (   !file.read(header, sizeof(header))
+		|| std::memcmp(header, Magic, sizeof(Magic))
+		|| uint8_t(header[sizeof(Magic)]) != PackedVersion)
+		file.close();
+}
+
+// PackedReader::read() returns the next record of the file, refilling the
+// buffer when it is exhausted. Returns false at the end of the file; a
+// truncated last record and records that fail PackedPosition::is_ok() are
+// ignored, so that a corrupt file can not corrupt the board.
+bool PackedReader::read(PackedPosition& pp)
+{
+	do {
+		if (cur == size)
+		{
+			file.read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(PackedPosition));
+			size = size_t(file.gcount()) / sizeof(PackedPosition);
+			cur = 0;
+
+			if (!size)
+				return false;
+		}
+
+		pp = buffer[cur++];
+	} while (!pp.is_ok());
+
+	return true;
+}
@@ -0,0 +1,69 @@
+/*
+  Chameleon, a UCI chinese chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2017 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+  Copyright (C) 2017 Wilbert Lee
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef PACKED_H_INCLUDED
+#define PACKED_H_INCLUDED
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "position.h"
+
+// PackedWriter and PackedReader stream files of PackedPosition records. Records
+// are buffered and moved to and from the file a block at a time, so that
+// millions of positions can be stored or loaded at close to disk speed. A file
+// starts with a header record holding "CHPK" and the version of the format,
+// and PackedReader refuses files of another version.
+const uint8_t PackedVersion = 1;
+
+class PackedWriter
+{
+public:
+	explicit PackedWriter(const std::string& fileName, size_t blockSize = 4096);
+	~PackedWriter() { flush(); }
+
+	bool is_open() const { return file.is_open(); }
+	void write(const PackedPosition& pp);
+	void flush();
+
+private:
+	std::ofstream file;
+	std::vector<PackedPosition> buffer;
+	size_t size;
+};
+
+class PackedReader
+{
+public:
+	explicit PackedReader(const std::string& fileName, size_t blockSize = 4096);
+
+	bool is_open() const { return file.is_open(); }
+	bool read(PackedPosition& pp);
+
+private:
+	std::ifstream file;
+	std::vector<PackedPosition> buffer;
+	size_t cur, size;
+};
+
+#endif // #ifndef PACKED_H_INCLUDED
@@ -176,7 +176,6 @@ Position& Position::operator=(const Position& pos)
 	std::memcpy(this, &pos, sizeof(Position));
 	std::memcpy(&startState, st, sizeof(StateInfo));
 
-	nodes = 0;
 	st = &startState;
 
 	assert(pos_is_ok());
@@ -286,10 +285,93 @@ void Position::set(const string& fenStr, bool isChess960, Thread* th)
 
 	thisThread = th;
 	set_state(st);
+	mirrorKey = compute_mirror_key();
 
 	assert(pos_is_ok());
 }
 
+// PackedPosition::is_ok() checks that a record read from a file can be set up
+// safely: unused bits are clear, there are at most 32 pieces, every piece code
+// is valid and each side has exactly one king.
+bool PackedPosition::is_ok() const
+{
+	int n = 0, kings[COLOR_NB] = {};
+
+	if (occupied[11] & 0x7C)
+		return false;
+
+	for (int i = 0; i < SQUARE_NB; ++i)
+		if (occupied[i / 8] & (1 << (i % 8)))
+		{
+			if (n == 32)
+				return false;
+
+			Piece pc = Piece((pieces[n / 2] >> (4 * (n % 2))) & 0xF);
+
+			if (type_of(pc) == NO_PIECE_TYPE)
+				return false;
+
+			kings[color_of(pc)] += type_of(pc) == KING;
+			++n;
+		}
+
+	return kings[WHITE] == 1 && kings[BLACK] == 1;
+}
+
+// Position::set() initializes the position object from its packed form. It
+// is much faster than parsing a FEN string, and as with the FEN the input is
+// assumed to be a legal position, see PackedPosition::is_ok(). Pieces are visited in FEN order, so that
+// the piece lists come out exactly as if the position was set from its FEN.
+void Position::set(const PackedPosition& pp, Thread* th)
+{
+	int n = 0;
+
+	assert(pp.is_ok());
+
+	clear();
+
+	for (int i = 0; i < SQUARE_NB; ++i)
+		if (pp.occupied[i / 8] & (1 << (i % 8)))
+		{
+			Piece pc = Piece((pp.pieces[n / 2] >> (4 * (n % 2))) & 0xF);
+			put_piece(color_of(pc), type_of(pc), Square(VerticalFlip[i]));
+			++n;
+		}
+
+	sideToMove = pp.occupied[11] & 0x80 ? BLACK : WHITE;
+	gamePly = pp.gamePly;
+	st->rule50 = pp.rule50;
+
+	thisThread = th;
+	set_state(st);
+	mirrorKey = compute_mirror_key();
+
+	assert(pos_is_ok());
+}
+
+// Position::packed() returns the 32 bytes binary form of the position
+PackedPosition Position::packed() const
+{
+	PackedPosition pp = {};
+	int n = 0;
+
+	for (int i = 0; i < SQUARE_NB; ++i)
+		if (!empty(Square(VerticalFlip[i])))
+		{
+			assert(n < 32);
+
+			pp.occupied[i / 8] |= uint8_t(1 << (i % 8));
+			pp.pieces[n / 2] |= uint8_t(piece_on(Square(VerticalFlip[i])) << (4 * (n % 2)));
+			++n;
+		}
+
+	pp.occupied[11] |= uint8_t(sideToMove == BLACK ? 0x80 : 0);
+	pp.rule50 = uint16_t(st->rule50);
+	pp.gamePly = uint16_t(gamePly);
+
+	return pp;
+}
+
 // Position::set_state() computes the hash keys of the position, and other
 // data that once computed is updated incrementally as moves are made.
 // The function is only used when a new position is set up, and to verify
@@ -328,6 +410,22 @@ void Position::set_state(StateInfo* si) const
 			si->nonPawnMaterial[c] += pieceCount[c][pt] * PieceValue[MG][pt];
 }
 
+// Position::compute_mirror_key() computes from scratch the key of the
+// position with every piece moved to its HorizontalFlip square.
+uint64_t Position::compute_mirror_key() const
+{
+	uint64_t k = sideToMove == BLACK ? Zobrist::side : 0;
+
+	for (Bitboard b = pieces(); b; )
+	{
+		Square s = pop_lsb(&b);
+		Piece pc = piece_on(s);
+		k ^= Zobrist::psq[color_of(pc)][type_of(pc)][mirror(s)];
+	}
+
+	return k;
+}
+
 // Position::fen() returns a FEN representation of the position. In case of
 // Chess960 the Shredder-FEN notation is used. This is mainly a debugging function.
 const string Position::fen() const
@@ -371,7 +469,7 @@ const string Position::fen() const
 // material between endgame and midgame limits.
 Phase Position::game_phase() const
 {
-	Value npm = st->nonPawnMaterial[WHITE] + st->nonPawnMaterial[BLACK];
+	Value npm = non_pawn_material(WHITE) + non_pawn_material(BLACK);
 
 	npm = std::max(EG_LIMIT, std::min(npm, MG_LIMIT));
 
@@ -650,13 +748,14 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck)
 	assert(is_ok(m));
 	assert(&newSt != st);
 
-	++nodes;
+	++thisThread->nodes;
 	uint64_t k = st->key ^ Zobrist::side;
+	uint64_t mk = mirrorKey ^ Zobrist::side;
 
 	// Copy some fields of the old state to our new StateInfo object except the
 	// ones which are going to be recalculated from scratch anyway and then switch
 	// our state pointer to point to the new (ready to be updated) state.
-	std::memcpy(&newSt, st, offsetof(StateInfo, key));
+	std::memcpy(&newSt, st, offsetof(StateInfo, capturedType));
 	newSt.previous = st;
 	st = &newSt;
 
@@ -695,6 +794,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck)
 
 		// Update material hash key and prefetch access to materialTable
 		k ^= Zobrist::psq[them][captured][capsq];
+		mk ^= Zobrist::psq[them][captured][mirror(capsq)];
 		st->materialKey ^= Zobrist::psq[them][captured][pieceCount[them][captured]];
 
 		// Update incremental scores
@@ -706,6 +806,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck)
 
 	// Update hash key
 	k ^= Zobrist::psq[us][pt][from] ^ Zobrist::psq[us][pt][to];
+	mk ^= Zobrist::psq[us][pt][mirror(from)] ^ Zobrist::psq[us][pt][mirror(to)];
 
 	// Move the piece.	
 	move_piece(us, pt, from, to);
@@ -727,8 +828,9 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck)
 	// Set capture piece
 	st->capturedType = captured;
 
-	// Update the key with the final value
+	// Update the keys with the final values
 	st->key = k;
+	mirrorKey = mk;
 
 	// Calculate checkers bitboard (if move gives check)
 	st->checkersBB = get_checkers(us, square<KING>(them));//givesCheck ? get_checkers(us, square<KING>(them)) : Bitboard(); // 
@@ -740,6 +842,17 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck)
 	assert(pos_is_ok());
 }
 
+// Position::copy_make() sets the position to the one reached by playing 'm'
+// in 'parent', which is left untouched. Only the members before startState are
+// copied: the state pointer keeps referring to the parent's history, so the
+// new state links to it exactly as with do_move(). Used by the copy-make
+// search, where a child position is simply dropped instead of undone.
+void Position::copy_make(const Position& parent, Move m, StateInfo& newSt, bool givesCheck)
+{
+	std::memcpy(this, &parent, offsetof(Position, startState));
+	do_move(m, newSt, givesCheck);
+}
+
 Bitboard Position::get_checkers(Color checker, Square ksq) const
 {
 	return	(PawnAttackTo[checker][ksq] & pieces(checker, PAWN))
@@ -784,12 +897,14 @@ void Position::undo_move(Move m)
 	assert(st->capturedType != KING);
 
 	move_piece(us, pt, to, from); // Put the piece back at the source square
+	mirrorKey ^= Zobrist::side ^ Zobrist::psq[us][pt][mirror(from)] ^ Zobrist::psq[us][pt][mirror(to)];
 
 	if (st->capturedType)
 	{
 		Square capsq = to;
 
-		put_piece(~us, st->capturedType, capsq); // Restore the captured piece
+		put_piece(~us, PieceType(st->capturedType), capsq); // Restore the captured piece
+		mirrorKey ^= Zobrist::psq[~us][st->capturedType][mirror(capsq)];
 	}
 
 	// Finally point our state pointer back to the previous state
@@ -812,6 +927,7 @@ void Position::do_null_move(StateInfo& newSt)
 	st = &newSt;
 
 	st->key ^= Zobrist::side;
+	mirrorKey ^= Zobrist::side;
 	prefetch(TT.first_entry(st->key));
 
 	++st->rule50;
@@ -827,6 +943,7 @@ void Position::undo_null_move()
 	assert(!checkers());
 
 	st = st->previous;
+	mirrorKey ^= Zobrist::side;
 	sideToMove = ~sideToMove;
 }
 
@@ -848,6 +965,53 @@ uint64_t Position::key_after(Move m) const
 	return k ^ Zobrist::psq[us][pt][to] ^ Zobrist::psq[us][pt][from];
 }
 
+// Position::mirror_key_after() computes the mirror key after the given move,
+// as do_move() updates it, for the prefetch with the "Mirror Hash" option.
+uint64_t Position::mirror_key_after(Move m) const
+{
+	Color us = sideToMove;
+	Square from = from_sq(m);
+	Square to = to_sq(m);
+	PieceType pt = type_of(piece_on(from));
+	PieceType captured = type_of(piece_on(to));
+	uint64_t k = mirrorKey ^ Zobrist::side;
+
+	if (captured)
+		k ^= Zobrist::psq[~us][captured][mirror(to)];
+
+	return k ^ Zobrist::psq[us][pt][mirror(to)] ^ Zobrist::psq[us][pt][mirror(from)];
+}
+
+// Position::pawn_key_after() and Position::material_key_after() compute the
+// pawn and material keys after the given move, as do_move() updates them, to
+// prefetch the entries of the pawn and material tables of the child.
+uint64_t Position::pawn_key_after(Move m) const
+{
+	Color us = sideToMove;
+	Square from = from_sq(m);
+	Square to = to_sq(m);
+	uint64_t k = st->pawnKey;
+
+	if (type_of(piece_on(to)) == PAWN)
+		k ^= Zobrist::psq[~us][PAWN][to];
+
+	if (type_of(piece_on(from)) == PAWN)
+		k ^= Zobrist::psq[us][PAWN][from] ^ Zobrist::psq[us][PAWN][to];
+
+	return k;
+}
+
+uint64_t Position::material_key_after(Move m) const
+{
+	Color them = ~sideToMove;
+	PieceType captured = type_of(piece_on(to_sq(m)));
+
+	if (!captured)
+		return st->materialKey;
+
+	return st->materialKey ^ Zobrist::psq[them][captured][pieceCount[them][captured] - 1];
+}
+
 // Position::see() is a static exchange evaluator: It tries to estimate the
 // material gain or loss resulting from a move.
 Value Position::see_sign(Move m) const
@@ -940,6 +1104,27 @@ bool Position::is_draw() const
 	return false;
 }
 
+// Position::is_draw_after() tells whether the child with key 'childKey',
+// reached by a reversible move, could be a draw for is_draw(): it repeats a
+// position of the game or the 50 moves counter runs out. Used to look up a
+// child in the TT without making the move.
+bool Position::is_draw_after(uint64_t childKey) const
+{
+	if (st->rule50 >= 99)
+		return true;
+
+	StateInfo* stp = st;
+	for (int i = 1, e = std::min(st->rule50, st->pliesFromNull); i <= e; i += 2)
+	{
+		stp = i == 1 ? stp->previous : stp->previous->previous;
+
+		if (stp->key == childKey)
+			return true;
+	}
+
+	return false;
+}
+
 int Position::is_repeat()const
 {
 	bool oppcheck = true;
@@ -1052,7 +1237,8 @@ bool Position::pos_is_ok(int* failedStep) const
 		{
 			StateInfo si = *st;
 			set_state(&si);
-			if (std::memcmp(&si, st, sizeof(StateInfo)))
+			if (std::memcmp(&si, st, sizeof(StateInfo))
+				|| mirrorKey != compute_mirror_key())
 				return false;
 		}
 
@@ -23,6 +23,7 @@
 #ifndef POSITION_H_INCLUDED
 #define POSITION_H_INCLUDED
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>  // For offsetof()
 #include <string>
@@ -72,25 +73,46 @@ struct CheckInfo
 // StateInfo struct stores information needed to restore a Position object to
 // its previous state when we retract a move. Whenever a move is made on the
 // board (by calling Position::do_move), a StateInfo object must be passed.
+//
+// The layout is packed to fit a single cache line: the fields copied by
+// do_move() form a contiguous prefix ending at capturedType, the remaining
+// ones are recomputed for every new state.
 struct StateInfo
 {
 	// Copied when making a move
-	uint64_t    pawnKey;
-	uint64_t    materialKey;
-	Value  nonPawnMaterial[COLOR_NB];
-
-	int    rule50;
-	int    pliesFromNull;
-	Score  psq;
+	uint64_t   pawnKey;
+	uint64_t   materialKey;
+	Score      psq;
+	int16_t    nonPawnMaterial[COLOR_NB];
+	int16_t    rule50;
+	int16_t    pliesFromNull;
 
 	// Not copied when making a move
-	uint64_t        key;
-	Bitboard   checkersBB;
-	PieceType  capturedType;
+	uint8_t    capturedType;
+	uint64_t   key;
 	StateInfo* previous;
+	Bitboard   checkersBB;
+};
 
+static_assert(sizeof(StateInfo) <= 64, "StateInfo does not fit a cache line");
+
+// PackedPosition is a compact, fixed size binary form of a position, used to
+// store large sets of positions. It holds a 90 bits occupancy map followed by
+// the side to move bit, the piece codes of the occupied squares as nibbles
+// (up to 32 pieces), the rule50 counter and the game ply. Squares are in FEN
+// order, from A9 to I0, and fields are in host byte order.
+struct PackedPosition
+{
+	uint8_t occupied[12];
+	uint8_t pieces[16];
+	uint16_t rule50;
+	uint16_t gamePly;
+
+	bool is_ok() const;
 };
 
+static_assert(sizeof(PackedPosition) == 32, "PackedPosition is not 32 bytes");
+
 // Position class stores information regarding the board representation as
 // pieces, side to move, hash keys, castling info, etc. Important methods are
 // do_move() and undo_move(), used by the search to update node info when
@@ -105,6 +127,7 @@ public:
 	Position(const Position&) = delete;
 	Position(const Position& pos, Thread* th) { *this = pos; thisThread = th; }
 	Position(const std::string& f, bool c960, Thread* th) { set(f, c960, th); }
+	Position(const PackedPosition& pp, Thread* th) { set(pp, th); }
 
 	// To assign RootPos from UCI
 	Position& operator=(const Position&);
@@ -113,6 +136,10 @@ public:
 	void set(const std::string& fenStr, bool isChess960, Thread* th);
 	const std::string fen() const;
 
+	// Packed binary input/output
+	void set(const PackedPosition& pp, Thread* th);
+	PackedPosition packed() const;
+
 	// Position representation
 	Bitboard pieces() const;
 	Bitboard pieces(PieceType pt) const;
@@ -124,7 +151,7 @@ public:
 
 	bool empty(Square s) const;
 	template<PieceType Pt> int count(Color c) const;
-	template<PieceType Pt> const Square* squares(Color c) const;
+	template<PieceType Pt> const uint8_t* squares(Color c) const;
 	template<PieceType Pt> Square square(Color c) const;
 
 	// Checking
@@ -160,6 +187,7 @@ public:
 	// Doing and undoing moves
 	void do_move(Move m, StateInfo& st, bool givesCheck);
 	void undo_move(Move m);
+	void copy_make(const Position& parent, Move m, StateInfo& st, bool givesCheck);
 	void do_null_move(StateInfo& st);
 	void undo_null_move();
 
@@ -172,7 +200,12 @@ public:
 	uint64_t key_after(Move m) const;
 	uint64_t exclusion_key() const;
 	uint64_t material_key() const;
+	uint64_t material_key_after(Move m) const;
 	uint64_t pawn_key() const;
+	uint64_t pawn_key_after(Move m) const;
+	uint64_t mirror_key() const;
+	uint64_t mirror_key_after(Move m) const;
+	uint64_t canonical_key() const;
 
 	// Other properties of the position
 	Color side_to_move() const;
@@ -180,9 +213,8 @@ public:
 	int game_ply() const;
 
 	Thread* this_thread() const;
-	uint64_t nodes_searched() const;
-	void set_nodes_searched(uint64_t n);
 	bool is_draw() const;
+	bool is_draw_after(uint64_t childKey) const;
 	int  is_repeat()const;
 	int rule50_count() const;
 	Score psq_score() const;
@@ -196,6 +228,7 @@ private:
 	// Initialization helpers (used while setting up a position)
 	void clear();
 	void set_state(StateInfo* si) const;
+	uint64_t compute_mirror_key() const;
 
 	// Other helpers
 	Bitboard check_blockers(Color c, Color kingColor) const;
@@ -203,20 +236,22 @@ private:
 	void remove_piece(Color c, PieceType pt, Square s);
 	void move_piece(Color c, PieceType pt, Square from, Square to);
 
-	// Data members
-	Piece board[SQUARE_NB];
+	// Data members. Members touched at every node come first, so that they
+	// share the leading cache lines; squares and counters are stored as bytes
+	// to keep the whole object small and cheap to copy.
 	Bitboard byTypeBB[PIECE_TYPE_NB];
 	Bitboard byColorBB[COLOR_NB];
-	int pieceCount[COLOR_NB][PIECE_TYPE_NB];
-	Square pieceList[COLOR_NB][PIECE_TYPE_NB][16];
-	int index[SQUARE_NB];
-
-	StateInfo startState;
-	uint64_t nodes;
+	StateInfo* st;
+	uint64_t mirrorKey;
+	Thread* thisThread;
 	int gamePly;
 	Color sideToMove;
-	Thread* thisThread;
-	StateInfo* st;
+	uint8_t board[SQUARE_NB];
+	uint8_t index[SQUARE_NB];
+	uint8_t pieceCount[COLOR_NB][PIECE_TYPE_NB];
+	uint8_t pieceList[COLOR_NB][PIECE_TYPE_NB][16];
+
+	StateInfo startState;
 };
 
 extern std::ostream& operator<<(std::ostream& os, const Position& pos);
@@ -233,12 +268,12 @@ inline bool Position::empty(Square s) const
 
 inline Piece Position::piece_on(Square s) const
 {
-	return board[s];
+	return Piece(board[s]);
 }
 
 inline Piece Position::moved_piece(Move m) const
 {
-	return board[from_sq(m)];
+	return Piece(board[from_sq(m)]);
 }
 
 inline Bitboard Position::pieces() const
@@ -276,7 +311,7 @@ template<PieceType Pt> inline int Position::count(Color c) const
 	return pieceCount[c][Pt];
 }
 
-template<PieceType Pt> inline const Square* Position::squares(Color c) const
+template<PieceType Pt> inline const uint8_t* Position::squares(Color c) const
 {
 	return pieceList[c][Pt];
 }
@@ -284,7 +319,7 @@ template<PieceType Pt> inline const Square* Position::squares(Color c) const
 template<PieceType Pt> inline Square Position::square(Color c) const
 {
 	assert(pieceCount[c][Pt] == 1);
-	return pieceList[c][Pt][0];
+	return Square(pieceList[c][Pt][0]);
 }
 
 template<PieceType Pt>
@@ -358,6 +393,21 @@ inline uint64_t Position::material_key() const
 	return st->materialKey;
 }
 
+// Position::mirror_key() is the key of the left-right mirror image of the
+// position. It is kept in Position rather than in StateInfo, and updated
+// both ways by do_move() and undo_move(), to keep StateInfo in a cache line.
+inline uint64_t Position::mirror_key() const
+{
+	return mirrorKey;
+}
+
+// Position::canonical_key() is the same for a position and its mirror image.
+// Callers that index by it must mirror moves when mirror_key() < key().
+inline uint64_t Position::canonical_key() const
+{
+	return std::min(st->key, mirrorKey);
+}
+
 inline Score Position::psq_score() const
 {
 	return st->psq;
@@ -365,7 +415,7 @@ inline Score Position::psq_score() const
 
 inline Value Position::non_pawn_material(Color c) const
 {
-	return st->nonPawnMaterial[c];
+	return Value(st->nonPawnMaterial[c]);
 }
 
 inline int Position::game_ply() const
@@ -378,16 +428,6 @@ inline int Position::rule50_count() const
 	return st->rule50;
 }
 
-inline uint64_t Position::nodes_searched() const
-{
-	return nodes;
-}
-
-inline void Position::set_nodes_searched(uint64_t n)
-{
-	nodes = n;
-}
-
 inline bool Position::opposite_bishops() const
 {
 	return   pieceCount[WHITE][BISHOP] == 1
@@ -403,7 +443,7 @@ inline bool Position::capture(Move m) const
 
 inline PieceType Position::captured_piece_type() const
 {
-	return st->capturedType;
+	return PieceType(st->capturedType);
 }
 
 inline Thread* Position::this_thread() const
@@ -432,7 +472,7 @@ inline void Position::remove_piece(Color c, PieceType pt, Square s)
 	byTypeBB[pt] ^= s;
 	byColorBB[c] ^= s;
 	/* board[s] = NO_PIECE;  Not needed, overwritten by the capturing one */
-	Square lastSquare = pieceList[c][pt][--pieceCount[c][pt]];
+	Square lastSquare = Square(pieceList[c][pt][--pieceCount[c][pt]]);
 	index[lastSquare] = index[s];
 	pieceList[c][pt][index[lastSquare]] = lastSquare;
 	pieceList[c][pt][pieceCount[c][pt]] = SQ_NONE;
@@ -24,6 +24,7 @@
 #include <cassert>
 #include <cmath>
 #include <cstring>   // For std::memset
+#include <functional>
 #include <iostream>
 #include <sstream>
 
@@ -41,7 +42,8 @@ namespace Search
 {
 	SignalsType Signals;
 	LimitsType Limits;
-	StateStackPtr SetupStates;
+	StateArena SetupStates;
+	StopLatency StopLatencies;
 }
 
 namespace Tablebases
@@ -122,9 +124,14 @@ namespace
 	EasyMoveManager EasyMove;
 	Value DrawValue[COLOR_NB];
 	Value MateValue[COLOR_NB];
+	bool MirrorHash, HotHash, Etc, Abdada, Ybwc, Deterministic;
+	Depth SplitDepth; // Minimum depth of the YBWC split points
+	size_t MultiPV;   // Number of PV lines, at most the number of root moves
+	std::atomic<uint64_t> NodesLeft; // Node limit not yet handed out to the threads
+	const uint64_t NodeChunk = 1024;
 	CounterMovesHistoryStats CounterMovesHistory;
 
-	template <NodeType NT>
+	template <NodeType NT, bool SpNode = false>
 	Value search(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth, bool cutNode);
 
 	template <NodeType NT, bool InCheck>
@@ -134,7 +141,167 @@ namespace
 	Value value_from_tt(Value v, int ply);
 	void update_pv(Move* pv, Move move, Move* childPv);
 	void update_stats(const Position& pos, Stack* ss, Move move, Depth depth, Move* quiets, int quietsCnt);
-	void check_time();
+
+	// Moves are made on the search path either in place, with do_move() and
+	// undo_move(), or when compiled with USE_COPY_MAKE on a fresh copy of the
+	// parent position that is simply dropped once the child has been searched.
+	// make_child() returns the position to search the child on.
+#ifdef USE_COPY_MAKE
+	struct ChildPosition { Position pos; };
+
+	Position& make_child(Position& pos, ChildPosition& child, Move m, StateInfo& st, bool givesCheck)
+	{
+		child.pos.copy_make(pos, m, st, givesCheck);
+		return child.pos;
+	}
+
+	void unmake_child(Position&, Move) {}
+#else
+	struct ChildPosition {};
+
+	Position& make_child(Position& pos, ChildPosition&, Move m, StateInfo& st, bool givesCheck)
+	{
+		pos.do_move(m, st, givesCheck);
+		return pos;
+	}
+
+	void unmake_child(Position& pos, Move m) { pos.undo_move(m); }
+#endif
+
+	// With the "Mirror Hash" option the TT is indexed by the canonical key, so
+	// that a position and its left-right mirror image share their entry. When
+	// the position is looked up through its mirror image, moves are stored
+	// and read back mirrored.
+	uint64_t tt_key(const Position& pos, bool& mirrored)
+	{
+		mirrored = MirrorHash && pos.mirror_key() < pos.key();
+		return mirrored ? pos.mirror_key() : pos.key();
+	}
+
+	Move tt_move(Move m, bool mirrored)
+	{
+		return mirrored ? mirror(m) : m;
+	}
+
+	// With the "Hot Hash" option the nodes at depth ONE_PLY or below, qsearch
+	// included, probe and store their entries in the hot tier of the thread,
+	// and only the deeper nodes use the main TT.
+	const Depth HotDepth = ONE_PLY;
+
+	// Enhanced transposition cutoffs are tried at non-PV nodes of at least
+	// EtcDepth, looking up the first EtcMoves children
+	const Depth EtcDepth = 4 * ONE_PLY;
+	const size_t EtcMoves = 16;
+
+	// SearchingTable is the lock-free hash set of the ABDADA scheme, enabled
+	// with the "ABDADA" option: a thread marks the (key, depth) pairs of the
+	// children it is searching, and at non-PV nodes the other threads defer
+	// the moves to the marked children to the end of their move list, so that
+	// they search something else meanwhile. A slot holds the key with its low
+	// byte replaced by the depth, 0 when free. When a slot is taken the child
+	// is simply not marked.
+	struct SearchingTable
+	{
+		static const int Size = 1 << 14;
+
+		static uint64_t tag(uint64_t key, Depth d) { return (key & ~0xFFULL) | uint8_t(d); }
+
+		std::atomic<uint64_t>* mark(uint64_t key, Depth d)
+		{
+			std::atomic<uint64_t>& slot = table[key & (Size - 1)];
+			uint64_t empty = 0;
+
+			return slot.compare_exchange_strong(empty, tag(key, d), std::memory_order_relaxed) ? &slot : nullptr;
+		}
+
+		bool marked(uint64_t key, Depth d) const
+		{
+			return table[key & (Size - 1)].load(std::memory_order_relaxed) == tag(key, d);
+		}
+
+		std::atomic<uint64_t> table[Size];
+	};
+
+	SearchingTable Searching;
+	const Depth AbdadaDepth = 3 * ONE_PLY;
+	const int MaxDeferred = 32;
+
+	TTEntry* tt_probe(Thread* th, uint64_t key, Depth depth, bool& found, TTEntry& data)
+	{
+		return HotHash && depth <= HotDepth ? th->hotTable.probe(key, found, data)
+			: Deterministic ? th->ttBuffer.probe(key, found, data) : TT.probe(key, found, data);
+	}
+
+	TTEntry* tt_first_entry(Thread* th, uint64_t key, Depth depth)
+	{
+		return HotHash && depth <= HotDepth ? th->hotTable.entry(key) : TT.first_entry(key);
+	}
+
+	// In deterministic mode the threads do not share their counter move history
+	CounterMovesHistoryStats& counter_moves_history(Thread* th)
+	{
+		return Deterministic ? *th->counterMovesHistory : CounterMovesHistory;
+	}
+
+	// refill_budget() hands out to a thread that has searched all of its node
+	// budget the next chunk of the node limit, and returns false once there are
+	// no nodes left. Chunks get smaller towards the end, so that the threads
+	// run out of nodes at about the same time.
+	bool refill_budget(Thread* th)
+	{
+		uint64_t left = NodesLeft.load(std::memory_order_relaxed), chunk;
+
+		do {
+			if (!left)
+			{
+				// A YBWC thread can not stop alone, it may be a slave of a split point
+				if (Ybwc)
+					request_stop();
+
+				return false;
+			}
+
+			chunk = std::min(NodeChunk, (left + Threads.size() - 1) / Threads.size());
+
+		} while (!NodesLeft.compare_exchange_weak(left, left - chunk, std::memory_order_relaxed));
+
+		th->nodeBudget += chunk;
+		return true;
+	}
+
+	// stop_requested() tells whether the thread must stop searching. With a
+	// node limit each thread stops on its own once it has searched its node
+	// budget and there are no nodes left, so that the total never exceeds the
+	// limit by more than a few nodes per thread. In deterministic mode the
+	// budget is a fixed share of the limit, as the chunks handed out would
+	// depend on the speed of the other threads.
+	bool stop_requested(Thread* th)
+	{
+		return Signals.stop.load(std::memory_order_relaxed)
+			|| (th->nodes >= th->nodeBudget && !refill_budget(th));
+	}
+
+	// prefetch_child() prefetches the entries of the TT and of the pawn and
+	// material tables of the thread that the child reached by the given move
+	// is going to probe. The pawn and material keys change only on captures
+	// and pawn moves, otherwise the child uses the entries of the parent.
+	// With the "Mirror Hash" option the child probes its canonical key.
+	void prefetch_child(const Position& pos, Move m, Depth childDepth)
+	{
+		Thread* th = pos.this_thread();
+		uint64_t key = pos.key_after(m);
+
+		if (MirrorHash)
+			key = std::min(key, pos.mirror_key_after(m));
+
+		prefetch(tt_first_entry(th, key, childDepth));
+
+		if (pos.capture(m) || type_of(pos.moved_piece(m)) == PAWN)
+		{
+			prefetch(th->pawnsTable[pos.pawn_key_after(m)]);
+			prefetch(th->materialTable[pos.material_key_after(m)]);
+		}
+	}
 
 } // namespace
 
@@ -165,17 +332,56 @@ void Search::init()
 	}
 }
 
-// Search::clear() resets to zero search state, to obtain reproducible results
+// Search::clear() resets to zero search state, to obtain reproducible results.
+// The TT and the per-thread tables are cleared in parallel by the pool threads.
 void Search::clear()
 {
-	TT.clear();
+	Threads.clear();
 	CounterMovesHistory.clear();
+}
 
-	for (Thread* th : Threads)
+// Search::request_stop() raises the stop signal, recording when it is first
+// requested in a search, to measure the time taken to answer with the best
+// move.
+void Search::request_stop()
+{
+	TimePoint none = 0;
+
+	Signals.stopTime.compare_exchange_strong(none, now());
+	Signals.stop = true;
+}
+
+// StopLatency::add() counts a stop latency in its bucket
+void Search::StopLatency::add(TimePoint ms)
+{
+	int b = 0;
+
+	while (b < Buckets - 1 && ms >= (TimePoint(1) << b))
+		++b;
+
+	++count[b];
+	maxLatency = std::max(maxLatency, ms);
+}
+
+std::ostream& Search::operator<<(std::ostream& os, const StopLatency& h)
+{
+	os << "stop latency (ms)";
+
+	for (int b = 0; b < StopLatency::Buckets; ++b)
 	{
-		th->history.clear();
-		th->counterMoves.clear();
+		os << ' ';
+
+		if (b < 2)
+			os << b;
+		else if (b < StopLatency::Buckets - 1)
+			os << (1 << (b - 1)) << '-' << (1 << b) - 1;
+		else
+			os << (1 << (b - 1)) << '+';
+
+		os << ':' << h.count[b];
 	}
+
+	return os << " max " << h.maxLatency;
 }
 
 // Search::perft() is our utility to verify move generation. All the leaf nodes
@@ -184,6 +390,7 @@ template<bool Root>
 uint64_t Search::perft(Position& pos, Depth depth)
 {
 	StateInfo st;
+	ChildPosition child;
 	uint64_t cnt, nodes = 0;
 	CheckInfo ci(pos);
 	const bool leaf = (depth == 2 * ONE_PLY);
@@ -194,10 +401,10 @@ uint64_t Search::perft(Position& pos, Depth depth)
 			cnt = 1, nodes++;
 		else
 		{
-			pos.do_move(m, st, pos.gives_check(m, ci));
-			cnt = leaf ? MoveList<LEGAL>(pos).size() : perft<false>(pos, depth - ONE_PLY);
+			Position& next = make_child(pos, child, m, st, pos.gives_check(m, ci));
+			cnt = leaf ? MoveList<LEGAL>(next).size() : perft<false>(next, depth - ONE_PLY);
 			nodes += cnt;
-			pos.undo_move(m);
+			unmake_child(pos, m);
 		}
 		if (Root)
 			sync_cout << UCI::move(m, false) << ": " << cnt << sync_endl;
@@ -215,9 +422,38 @@ void MainThread::search()
 	Color us = rootPos.side_to_move();
 	Time.init(Limits, us, rootPos.game_ply());
 
+	// Only the node and depth limits give the same result at each run, so in
+	// deterministic mode the time limits are turned into a node limit, at the
+	// rate of the "Nodes Time" option, or ignored when it is not set.
+	if (Options["Deterministic"] && (Limits.use_time_management() || Limits.movetime))
+	{
+		int npmsec = Options["Nodes Time"];
+
+		if (npmsec) // Time.available() is already in nodes
+			Limits.nodes = Limits.movetime ? int64_t(Limits.movetime) * npmsec : Time.available();
+		else
+			Limits.depth = MAX_PLY;
+
+		Limits.movetime = 0;
+
+		sync_cout << "info string Deterministic search, time limits "
+			<< (npmsec ? "searched as " + std::to_string(Limits.nodes) + " nodes" : "ignored")
+			<< sync_endl;
+	}
+
+	Threads.timer->run(true);
+
 	int contempt = Options["Contempt"] * PieceValue[1][1] / 100; // From centipawns
 	DrawValue[us] = VALUE_DRAW - Value(contempt);
 	DrawValue[~us] = VALUE_DRAW + Value(contempt);
+	MirrorHash = Options["Mirror Hash"];
+	HotHash = Options["Hot Hash"];
+	Etc = Options["ETC"];
+	Deterministic = Options["Deterministic"];
+	Ybwc = Options["YBWC"] && Threads.size() > 1 && !Deterministic;
+	Abdada = Options["ABDADA"] && Threads.size() > 1 && !Ybwc && !Deterministic;
+	SplitDepth = (Threads.size() < 8 ? 4 : 7) * ONE_PLY;
+	MultiPV = std::min(size_t(Options["MultiPV"]), rootMoves.size());
 
 	if (rootMoves.empty())
 	{
@@ -228,11 +464,34 @@ void MainThread::search()
 	}
 	else
 	{
+		if (Deterministic)
+			Threads.start_sync();
+
+		NodesLeft = Deterministic ? 0 : Limits.nodes;
+
 		for (Thread* th : Threads)
 		{
 			th->maxPly = 0;
 			th->rootDepth = DEPTH_ZERO;
-			if (th != this)
+			th->nodeBudget = Limits.nodes ? 0 : UINT64_MAX;
+
+			// In deterministic mode the node limit is split evenly between the
+			// threads and each one has its own counter move history
+			if (Deterministic)
+			{
+				if (Limits.nodes)
+					th->nodeBudget = Limits.nodes / Threads.size()
+						+ (th->idx < Limits.nodes % Threads.size());
+
+				if (!th->counterMovesHistory)
+				{
+					th->counterMovesHistory.reset(new CounterMovesHistoryStats);
+					th->counterMovesHistory->clear();
+				}
+			}
+
+			// In YBWC mode the helpers sleep until booked at a split point
+			if (th != this && !Ybwc)
 			{
 				th->rootPos = Position(rootPos, th);
 				th->rootMoves = rootMoves;
@@ -259,8 +518,16 @@ void MainThread::search()
 		wait(Signals.stop);
 	}
 
-	// Stop the threads if not already stopped
+	// In deterministic mode or with a node limit the helpers are never stopped
+	// before they reach the limits of the search by themselves
+	if (Deterministic || Limits.nodes)
+		for (Thread* th : Threads)
+			if (th != this)
+				th->wait_for_search_finished();
+
+	// Stop the threads if not already stopped, and the timer
 	Signals.stop = true;
+	Threads.timer->run(false);
 
 	// Wait until all threads have finished
 	for (Thread* th : Threads)
@@ -270,6 +537,7 @@ void MainThread::search()
 	// Check if there are threads with a better score than main thread
 	Thread* bestThread = this;
 	if (!this->easyMovePlayed
+		&& !Ybwc
 		&&  Options["MultiPV"] == 1)
 	{
 		for (Thread* th : Threads)
@@ -282,6 +550,11 @@ void MainThread::search()
 	if (bestThread != this)
 		sync_cout << UCI::pv(bestThread->rootPos, bestThread->completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
 
+	// Report the exact number of nodes searched, now that all threads are done
+	else if (Limits.nodes)
+		sync_cout << "info nodes " << Threads.nodes_searched()
+		<< " time " << Time.elapsed() << sync_endl;
+
 	sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], false);
 
 	if (bestThread->rootMoves[0].pv[0] != MOVE_NONE)
@@ -289,6 +562,9 @@ void MainThread::search()
 			std::cout << " ponder " << UCI::move(bestThread->rootMoves[0].pv[1], false);
 
 	std::cout << sync_endl;
+
+	if (Signals.stopTime)
+		StopLatencies.add(now() - Signals.stopTime);
 }
 
 // Thread::search() is the main iterative deepening loop. It calls search()
@@ -316,143 +592,165 @@ void Thread::search()
 		TT.new_search();
 	}
 
-	size_t multiPV = Options["MultiPV"];
+	// Helper threads skip depths in blocks: helper n searches 'skipSize'
+	// depths, then skips as many, starting at its own phase. Helpers are given
+	// the (size, phase) pairs in order, 2 phases of size 1, then 4 of size 2,
+	// 6 of size 3 and so on, so that each extra helper gets a pattern of its
+	// own and the depths stay evenly covered whatever the number of threads.
+	int skipSize = 0, skipPhase = 0;
 
-	multiPV = std::min(multiPV, rootMoves.size());
+	if (!mainThread)
+	{
+		skipPhase = int(idx - 1);
+
+		while (skipPhase >= 2 * ++skipSize)
+			skipPhase -= 2 * skipSize;
+
+		// Diversify the helpers further: shuffle the order of the root moves
+		// after the first one, and vary the LMR reductions.
+		if (rootMoves.size() > 2)
+			std::rotate(rootMoves.begin() + 1,
+				rootMoves.begin() + 1 + idx % (rootMoves.size() - 1), rootMoves.end());
+
+		reductionOffset = idx % 3 == 1 ? ONE_PLY : idx % 3 == 2 ? -ONE_PLY : DEPTH_ZERO;
+	}
+	else
+		reductionOffset = DEPTH_ZERO;
 
 	// Iterative deepening loop until requested to stop or target depth reached
-	while (++rootDepth < DEPTH_MAX && !Signals.stop && (!Limits.depth || rootDepth <= Limits.depth))
+	while (++rootDepth < DEPTH_MAX && !stop_requested(this) && (!Limits.depth || rootDepth <= Limits.depth))
 	{
-		// Set up the new depth for the helper threads skipping in average each
-		// 2nd ply (using a half density map similar to a Hadamard matrix).
-		if (!mainThread)
-		{
-			int d = rootDepth + rootPos.game_ply();
+		// In deterministic mode the threads start each iteration together, once
+		// the TT writes of the previous ones have been applied in thread order
+		if (Deterministic)
+			Threads.sync();
 
-			if (idx <= 6 || idx > 24)
-			{
-				if (((d + idx) >> (msb(idx + 1) - 1)) % 2)
-					continue;
-			}
-			else
-			{
-				// Table of values of 6 bits with 3 of them set
-				static const int HalfDensityMap[] =
-				{
-								  0x07, 0x0b, 0x0d, 0x0e, 0x13, 0x16, 0x19, 0x1a, 0x1c,
-								  0x23, 0x25, 0x26, 0x29, 0x2c, 0x31, 0x32, 0x34, 0x38
-				};
-
-				if ((HalfDensityMap[idx - 7] >> (d % 6)) & 1)
-					continue;
-			}
-		}
+		if (   !mainThread
+			&& ((rootDepth / ONE_PLY + rootPos.game_ply() + skipPhase) / skipSize) % 2)
+			continue;
 
 		// Age out PV variability metric
 		if (mainThread)
 			mainThread->bestMoveChanges *= 0.505, mainThread->failedLow = false;
 
-		// Save the last iteration's scores before first PV line is searched and
-		// all the move scores except the (new) PV are set to -VALUE_INFINITE.
+		// Save the last iteration's scores before the root moves are searched
+		// and all the move scores except the (new) PV lines are set to
+		// -VALUE_INFINITE.
 		for (RootMove& rm : rootMoves)
 			rm.previousScore = rm.score;
 
-		// MultiPV loop. We perform a full root search for each PV line
-		for (PVIdx = 0; PVIdx < multiPV && !Signals.stop; ++PVIdx)
+		// Reset aspiration window starting size, a bit different for each
+		// helper thread. In MultiPV mode all the PV lines are searched in a
+		// single pass, and the window goes from the last PV line to the first.
+		if (rootDepth >= 5 * ONE_PLY)
 		{
-			// Reset aspiration window starting size
-			if (rootDepth >= 5 * ONE_PLY)
-			{
-				delta = Value(18);
-				alpha = std::max(rootMoves[PVIdx].previousScore - delta, -VALUE_INFINITE);
-				beta = std::min(rootMoves[PVIdx].previousScore + delta, VALUE_INFINITE);
-			}
+			delta = Value(18 + 2 * int(idx % 4));
+			alpha = std::max(rootMoves[MultiPV - 1].previousScore - delta, -VALUE_INFINITE);
+			beta = std::min(rootMoves[0].previousScore + delta, VALUE_INFINITE);
+		}
+
+		// Distribute the PV lines between the threads: in MultiPV mode each
+		// helper starts with a different line, searched first with a full window
+		if (!mainThread && MultiPV > 1)
+			std::rotate(rootMoves.begin(), rootMoves.begin() + idx % MultiPV,
+				rootMoves.begin() + MultiPV);
+
+		// Start with a small aspiration window and, in the case of a fail
+		// high/low, re-search with a bigger window until we're not failing
+		// high/low anymore.
+		while (true)
+		{
+			// Only the moves given a score by this pass are shown at this depth
+			for (RootMove& rm : rootMoves)
+				rm.score = -VALUE_INFINITE;
+
+			bestValue = ::search<Root>(rootPos, ss, alpha, beta, rootDepth, false);
+
+			// Bring the best moves to the front. It is critical that sorting
+			// is done with a stable algorithm because all the values but the
+			// PV lines are set to -VALUE_INFINITE and we want to keep the same
+			// order for all the moves except the new PV lines that go to the
+			// front.
+			std::stable_sort(rootMoves.begin(), rootMoves.end());
+
+			// Write PV back to transposition table in case the relevant
+			// entries have been overwritten during the search.
+			for (size_t i = 0; i < MultiPV; i++)
+				rootMoves[i].insert_pv_in_tt(rootPos);
+
+			// If search has been stopped break immediately. Sorting and
+			// writing PV back to TT is safe because RootMoves is still
+			// valid, although it refers to previous iteration.
+			if (stop_requested(this))
+				break;
 
-			// Start with a small aspiration window and, in the case of a fail
-			// high/low, re-search with a bigger window until we're not failing
-			// high/low anymore.
-			while (true)
+			// When failing high/low give some update (without cluttering
+			// the UI) before a re-search.
+			if (mainThread
+				&& MultiPV == 1
+				&& (bestValue <= alpha || bestValue >= beta)
+				&& Time.elapsed() > 3000)
+				sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
+
+			// In case of failing low/high increase aspiration window and
+			// re-search, otherwise exit the loop. In MultiPV mode the search
+			// returns the score of the last PV line, and alpha is kept on a
+			// fail high as it bounds that line rather than the first one.
+			if (bestValue <= alpha)
 			{
-				bestValue = ::search<Root>(rootPos, ss, alpha, beta, rootDepth, false);
-
-				// Bring the best move to the front. It is critical that sorting
-				// is done with a stable algorithm because all the values but the
-				// first and eventually the new best one are set to -VALUE_INFINITE
-				// and we want to keep the same order for all the moves except the
-				// new PV that goes to the front. Note that in case of MultiPV
-				// search the already searched PV lines are preserved.
-				std::stable_sort(rootMoves.begin() + PVIdx, rootMoves.end());
-
-				// Write PV back to transposition table in case the relevant
-				// entries have been overwritten during the search.
-				for (size_t i = 0; i <= PVIdx; i++)
-					rootMoves[i].insert_pv_in_tt(rootPos);
-
-				// If search has been stopped break immediately. Sorting and
-				// writing PV back to TT is safe because RootMoves is still
-				// valid, although it refers to previous iteration.
-				if (Signals.stop)
-					break;
+				beta = (alpha + beta) / 2;
+				alpha = std::max(bestValue - delta, -VALUE_INFINITE);
 
-				// When failing high/low give some update (without cluttering
-				// the UI) before a re-search.
-				if (mainThread
-					&& multiPV == 1
-					&& (bestValue <= alpha || bestValue >= beta)
-					&& Time.elapsed() > 3000)
-					sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
-
-				// In case of failing low/high increase aspiration window and
-				// re-search, otherwise exit the loop.
-				if (bestValue <= alpha)
+				if (mainThread)
 				{
-					beta = (alpha + beta) / 2;
-					alpha = std::max(bestValue - delta, -VALUE_INFINITE);
-
-					if (mainThread)
-					{
-						mainThread->failedLow = true;
-						Signals.stopOnPonderhit = false;
-					}
+					mainThread->failedLow = true;
+					Signals.stopOnPonderhit = false;
 				}
-				else if (bestValue >= beta)
-				{
+			}
+			else if (bestValue >= beta)
+			{
+				if (MultiPV == 1)
 					alpha = (alpha + beta) / 2;
-					beta = std::min(bestValue + delta, VALUE_INFINITE);
-				}
-				else
-					break;
-
-				delta += delta / 4 + 5;
 
-				assert(alpha >= -VALUE_INFINITE && beta <= VALUE_INFINITE);
+				beta = std::min(bestValue + delta, VALUE_INFINITE);
 			}
+			else
+				break;
 
-			// Sort the PV lines searched so far and update the GUI
-			std::stable_sort(rootMoves.begin(), rootMoves.begin() + PVIdx + 1);
+			delta += delta / 4 + 5;
 
-			if (!mainThread)
-				break;
+			assert(alpha >= -VALUE_INFINITE && beta <= VALUE_INFINITE);
+		}
 
-			if (Signals.stop)
+		// Update the GUI
+		if (mainThread)
+		{
+			if (stop_requested(this))
 				sync_cout << "info nodes " << Threads.nodes_searched()
 				<< " time " << Time.elapsed() << sync_endl;
 
-			else if (PVIdx + 1 == multiPV || Time.elapsed() > 3000)
+			else
 				sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
 		}
 
-		if (!Signals.stop)
+		if (!stop_requested(this))
 			completedDepth = rootDepth;
 
-		if (!mainThread)
-			continue;
-
-		// Have we found a "mate in x"?
+		// Have we found a "mate in x"? In deterministic mode each thread stops
+		// on its own.
 		if (Limits.mate
+			&& (mainThread || Deterministic)
 			&& bestValue >= VALUE_MATE_IN_MAX_PLY
 			&& VALUE_MATE - bestValue <= 2 * Limits.mate)
-			Signals.stop = true;
+		{
+			if (Deterministic)
+				break;
+
+			request_stop();
+		}
+
+		if (!mainThread)
+			continue;
 
 		// Do we have time for the next iteration? Can we stop searching now?
 		if (Limits.use_time_management())
@@ -460,7 +758,7 @@ void Thread::search()
 			if (!Signals.stop && !Signals.stopOnPonderhit)
 			{
 				// Take some extra time if the best move has changed
-				if (rootDepth > 4 * ONE_PLY && multiPV == 1)
+				if (rootDepth > 4 * ONE_PLY && MultiPV == 1)
 					Time.pv_instability(mainThread->bestMoveChanges);
 
 				// Stop the search if only one legal move is available or all
@@ -477,7 +775,7 @@ void Thread::search()
 					if (Limits.ponder)
 						Signals.stopOnPonderhit = true;
 					else
-						Signals.stop = true;
+						request_stop();
 				}
 			}
 
@@ -488,6 +786,9 @@ void Thread::search()
 		}
 	}
 
+	if (Deterministic)
+		Threads.sync(true);
+
 	if (!mainThread)
 		return;
 
@@ -497,10 +798,52 @@ void Thread::search()
 		EasyMove.clear();
 }
 
+// Thread::search_split_point() searches the moves of a split point together
+// with the other threads booked on it. The thread works on its own copy of the
+// position and of the stack entries around the split node, so that the ones of
+// the master, referenced by the move picker, are left untouched.
+void Thread::search_split_point(SplitPoint* sp)
+{
+	Stack stack[MAX_PLY + 4], *ss = stack + 2; // To allow referencing (ss-2) and (ss+2)
+	SplitPoint* parent = activeSplitPoint;
+
+	sp->mutex.lock();
+
+	assert(sp->slavesMask.test(idx));
+
+	Position pos(*sp->pos, this);
+
+	std::memcpy(ss - 2, sp->ss - 2, 5 * sizeof(Stack));
+	ss->splitPoint = sp;
+	activeSplitPoint = sp;
+
+	if (sp->nodeType == NonPV)
+		::search<NonPV, true>(pos, ss, sp->alpha, sp->beta, sp->depth, sp->cutNode);
+	else
+		::search<PV, true>(pos, ss, sp->alpha, sp->beta, sp->depth, sp->cutNode);
+
+	// The split point is left with its mutex still locked by search<>()
+	sp->slavesMask.reset(idx);
+	sp->allSlavesSearching = false;
+	activeSplitPoint = parent;
+	bool finished = sp->slavesMask.none();
+	Thread* master = sp->master;
+	sp->mutex.unlock();
+
+	// The last slave to leave wakes up the master, sleeping in split()
+	if (finished && master != this)
+	{
+		std::unique_lock<Mutex> lk(master->mutex);
+		master->sleepCondition.notify_all();
+	}
+}
+
 namespace
 {
-	// search<>() is the main search function for both PV and non-PV nodes
-	template <NodeType NT>
+	// search<>() is the main search function for both PV and non-PV nodes and
+	// for the split points, where it is entered with the mutex of the split
+	// point locked and returns with it locked
+	template <NodeType NT, bool SpNode>
 	Value search(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth, bool cutNode)
 	{
 		const bool RootNode = NT == Root;
@@ -510,40 +853,50 @@ namespace
 		assert(PvNode || (alpha == beta - 1));
 		assert(DEPTH_ZERO < depth && depth < DEPTH_MAX);
 
-		Move pv[MAX_PLY + 1], quietsSearched[64];
+		Move pv[MAX_PLY + 1], quietsSearched[64], deferred[MaxDeferred];
 		StateInfo st;
+		ChildPosition child;
 		TTEntry* tte;
+		TTEntry ttData; // Entry read from the TT, checked against the key
 		uint64_t posKey;
 		Move ttMove, move, excludedMove, bestMove;
+#ifdef USE_PREFETCH_AHEAD
+		Move prefetched = MOVE_NONE;
+#endif
 		Depth extension, newDepth, predictedDepth;
 		Value bestValue, value, ttValue, eval, nullValue, futilityValue;
-		bool ttHit, inCheck, givesCheck, singularExtensionNode, improving;
+		bool ttHit, ttMirrored, inCheck, givesCheck, singularExtensionNode, improving;
 		bool captureOrPromotion, doFullDepthSearch;
-		int moveCount, quietCount;
+		int moveCount, quietCount, orderCount, deferredCount = 0, deferredIdx = 0;
+		int deferredCounts[MaxDeferred]; // Move count each deferred move would have had
+		SplitPoint* splitPoint;
 
 		// Step 1. Initialize node
 		Thread* thisThread = pos.this_thread();
 		inCheck = pos.checkers();
 		assert(pos.checkers() == pos.get_checkers(~pos.side_to_move(), pos.square<KING>(pos.side_to_move())));
 		assert(!pos.get_checkers(pos.side_to_move(), pos.square<KING>(~pos.side_to_move())));
+
+		if (SpNode)
+		{
+			splitPoint = ss->splitPoint;
+			bestMove = splitPoint->bestMove;
+			bestValue = splitPoint->bestValue;
+			tte = nullptr;
+			ttHit = ttMirrored = false;
+			ttMove = excludedMove = MOVE_NONE;
+			ttValue = VALUE_NONE;
+
+			assert(splitPoint->bestValue > -VALUE_INFINITE && splitPoint->moveCount > 0);
+
+			goto moves_loop;
+		}
+
 		moveCount = quietCount = ss->moveCount = 0;
 		bestValue = -VALUE_INFINITE;
 		ss->ply = (ss - 1)->ply + 1;
 		assert(!pos.in_check(~pos.side_to_move()));
 		// Check for available remaining time
-		if (thisThread->resetCalls.load(std::memory_order_relaxed))
-		{
-			thisThread->resetCalls = false;
-			thisThread->callsCnt = 0;
-		}
-		if (++thisThread->callsCnt > 4096)
-		{
-			for (Thread* th : Threads)
-				th->resetCalls = true;
-
-			check_time();
-		}
-
 		// Used to send selDepth info to GUI
 		if (PvNode && thisThread->maxPly < ss->ply)
 			thisThread->maxPly = ss->ply;
@@ -558,7 +911,7 @@ namespace
 			}
 
 			// Step 2. Check for aborted search and immediate draw
-			if (Signals.stop.load(std::memory_order_relaxed) || pos.is_draw() || ss->ply >= MAX_PLY)
+			if (stop_requested(thisThread) || pos.is_draw() || ss->ply >= MAX_PLY)
 				return ss->ply >= MAX_PLY && !inCheck ? evaluate(pos)
 				: DrawValue[pos.side_to_move()];
 
@@ -584,19 +937,20 @@ namespace
 		// search to overwrite a previous full search TT value, so we use a different
 		// position key in case of an excluded move.
 		excludedMove = ss->excludedMove;
-		posKey = excludedMove ? pos.exclusion_key() : pos.key();
-		tte = TT.probe(posKey, ttHit);
-		ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
-		ttMove = RootNode ? thisThread->rootMoves[thisThread->PVIdx].pv[0]
-			: ttHit ? tte->move() : MOVE_NONE;
+		ttMirrored = false;
+		posKey = excludedMove ? pos.exclusion_key() : tt_key(pos, ttMirrored);
+		tte = tt_probe(thisThread, posKey, depth, ttHit, ttData);
+		ttValue = ttHit ? value_from_tt(ttData.value(), ss->ply) : VALUE_NONE;
+		ttMove = RootNode ? thisThread->rootMoves[0].pv[0]
+			: ttHit ? tt_move(ttData.move(), ttMirrored) : MOVE_NONE;
 
 		// At non-PV nodes we check for an early TT cutoff
 		if (!PvNode
 			&& ttHit
-			&& tte->depth() >= depth
+			&& ttData.depth() >= depth
 			&& ttValue != VALUE_NONE // Possible in case of TT access race
-			&& (ttValue >= beta ? (tte->bound() & BOUND_LOWER)
-				: (tte->bound() & BOUND_UPPER)))
+			&& (ttValue >= beta ? (ttData.bound() & BOUND_LOWER)
+				: (ttData.bound() & BOUND_UPPER)))
 		{
 			ss->currentMove = ttMove; // Can be MOVE_NONE
 
@@ -604,6 +958,7 @@ namespace
 			if (ttValue >= beta && ttMove && !pos.capture(ttMove))
 				update_stats(pos, ss, ttMove, depth, nullptr, 0);
 
+			TT_STATS_INC(cutoffs);
 			return ttValue;
 		}
 
@@ -616,12 +971,12 @@ namespace
 		else if (ttHit)
 		{
 			// Never assume anything on values stored in TT
-			if ((ss->staticEval = eval = tte->eval()) == VALUE_NONE)
+			if ((ss->staticEval = eval = ttData.eval()) == VALUE_NONE)
 				eval = ss->staticEval = evaluate(pos);
 
 			// Can ttValue be used as a better position evaluation?
 			if (ttValue != VALUE_NONE)
-				if (tte->bound() & (ttValue > eval ? BOUND_LOWER : BOUND_UPPER))
+				if (ttData.bound() & (ttValue > eval ? BOUND_LOWER : BOUND_UPPER))
 					eval = ttValue;
 		}
 		else
@@ -724,9 +1079,9 @@ namespace
 				if (pos.legal(move, ci.pinned))
 				{
 					ss->currentMove = move;
-					pos.do_move(move, st, pos.gives_check(move, ci));
-					value = -search<NonPV>(pos, ss + 1, -rbeta, -rbeta + 1, rdepth, !cutNode);
-					pos.undo_move(move);
+					Position& next = make_child(pos, child, move, st, pos.gives_check(move, ci));
+					value = -search<NonPV>(next, ss + 1, -rbeta, -rbeta + 1, rdepth, !cutNode);
+					unmake_child(pos, move);
 					if (value >= rbeta)
 						return value;
 				}
@@ -742,15 +1097,73 @@ namespace
 			search<PvNode ? PV : NonPV>(pos, ss, alpha, beta, d, true);
 			ss->skipEarlyPruning = false;
 
-			tte = TT.probe(posKey, ttHit);
-			ttMove = ttHit ? tte->move() : MOVE_NONE;
+			tte = tt_probe(thisThread, posKey, depth, ttHit, ttData);
+			ttMove = ttHit ? tt_move(ttData.move(), ttMirrored) : MOVE_NONE;
+		}
+
+		// Step 10a. Enhanced transposition cutoff (skipped when in check)
+		// With the "ETC" option, before searching any move look up the children
+		// in the TT: a child already searched deep enough, whose value is an
+		// upper bound failing low for its side to move, refutes this node at
+		// once. Children are taken in the order of the MovePicker, so the most
+		// likely refutations are looked up first, and their keys are computed
+		// and prefetched first, so that the loads overlap, and then probed. A
+		// child that may be a draw by repetition or by the 50 moves rule is not
+		// trusted, as its TT value was found along another path. Children are
+		// looked up by their plain key only, so this is skipped with "Mirror
+		// Hash".
+		if (Etc
+			&& !PvNode
+			&&  depth >= EtcDepth
+			&& !excludedMove
+			&& !MirrorHash)
+		{
+			Square prevSq = to_sq((ss - 1)->currentMove);
+			MovePicker mp(pos, ttMove, depth, thisThread->history,
+				counter_moves_history(thisThread)[pos.piece_on(prevSq)][prevSq],
+				thisThread->counterMoves[pos.piece_on(prevSq)][prevSq], ss);
+			Move moves[EtcMoves];
+			uint64_t keys[EtcMoves];
+			size_t cnt = 0;
+			CheckInfo ci(pos);
+			bool childHit;
+
+			while (cnt < EtcMoves && (moves[cnt] = mp.next_move()) != MOVE_NONE)
+			{
+				prefetch(TT.first_entry(keys[cnt] = pos.key_after(moves[cnt])));
+				++cnt;
+			}
+
+			for (size_t i = 0; i < cnt; ++i)
+			{
+				TTEntry cte;
+				TT.probe(keys[i], childHit, cte, !Deterministic);
+				Value childValue = childHit ? value_from_tt(cte.value(), ss->ply + 1) : VALUE_NONE;
+
+				TT_STATS_INC(etcProbes);
+
+				if (childHit
+					&& childValue != VALUE_NONE
+					&& -childValue >= beta
+					&& cte.depth() >= depth - ONE_PLY
+					&& (cte.bound() & BOUND_UPPER)
+					&& !pos.is_draw_after(keys[i])
+					&& pos.legal(moves[i], ci.pinned))
+				{
+					tte->save(posKey, value_to_tt(-childValue, ss->ply), BOUND_LOWER, depth,
+						moves[i], ss->staticEval, TT.generation());
+
+					TT_STATS_ETC_CUTOFF(depth / ONE_PLY);
+					return -childValue;
+				}
+			}
 		}
 
 	moves_loop: // When in check search starts from here
 
 		Square prevSq = to_sq((ss - 1)->currentMove);
 		Move cm = thisThread->counterMoves[pos.piece_on(prevSq)][prevSq];
-		const CounterMovesStats& cmh = CounterMovesHistory[pos.piece_on(prevSq)][prevSq];
+		const CounterMovesStats& cmh = counter_moves_history(thisThread)[pos.piece_on(prevSq)][prevSq];
 
 		MovePicker mp(pos, ttMove, depth, thisThread->history, cmh, cm, ss);
 		CheckInfo ci(pos);
@@ -765,12 +1178,17 @@ namespace
 			/*  &&  ttValue != VALUE_NONE Already implicit in the next condition */
 			&&  abs(ttValue) < VALUE_KNOWN_WIN
 			&& !excludedMove // Recursive singular search is not allowed
-			&& (tte->bound() & BOUND_LOWER)
-			&& tte->depth() >= depth - 3 * ONE_PLY;
+			&& (ttData.bound() & BOUND_LOWER)
+			&& ttData.depth() >= depth - 3 * ONE_PLY;
+
+		if (RootNode)
+			thisThread->rootScores.clear();
 
 		// Step 11. Loop through moves
-		// Loop through all pseudo-legal moves until no moves remain or a beta cutoff occurs
-		while ((move = mp.next_move()) != MOVE_NONE)
+		// Loop through all pseudo-legal moves until no moves remain or a beta cutoff occurs,
+		// then through the moves deferred by ABDADA
+		while ((move = SpNode ? splitPoint->movePicker->next_move() : mp.next_move()) != MOVE_NONE
+			|| (deferredIdx < deferredCount && (move = deferred[deferredIdx++]) != MOVE_NONE))
 		{
 			assert(is_ok(move));
 
@@ -778,18 +1196,46 @@ namespace
 				continue;
 
 			// At root obey the "searchmoves" option and skip moves not listed in Root
-			// Move List. As a consequence any illegal move is also skipped. In MultiPV
-			// mode we also skip PV moves which have been already searched.
-			if (RootNode && !std::count(thisThread->rootMoves.begin() + thisThread->PVIdx,
+			// Move List. As a consequence any illegal move is also skipped.
+			if (RootNode && !std::count(thisThread->rootMoves.begin(),
 				thisThread->rootMoves.end(), move))
 				continue;
 
-			ss->moveCount = ++moveCount;
+			// Defer the move if another thread is searching its child, except the
+			// first move and the deferred moves themselves
+			if (Abdada
+				&& !PvNode
+				&&  moveCount
+				&& !deferredIdx
+				&&  depth >= AbdadaDepth
+				&&  deferredCount < MaxDeferred
+				&&  Searching.marked(pos.key_after(move), depth))
+			{
+				deferredCounts[deferredCount] = moveCount + 1;
+				deferred[deferredCount++] = move;
+				continue;
+			}
+
+			if (SpNode)
+			{
+				// Shared counter cannot be decremented later if the move turns out to be illegal
+				if (!pos.legal(move, ci.pinned))
+					continue;
+
+				ss->moveCount = moveCount = ++splitPoint->moveCount;
+				splitPoint->mutex.unlock();
+			}
+			else
+				ss->moveCount = ++moveCount;
+
+			// A deferred move is pruned and reduced by its place in the move
+			// order: ABDADA only delays its search
+			orderCount = deferredIdx ? deferredCounts[deferredIdx - 1] : moveCount;
 
 			if (RootNode && thisThread == Threads.main() && Time.elapsed() > 3000)
 				sync_cout << "info depth " << depth / ONE_PLY
 				<< " currmove " << UCI::move(move, false)
-				<< " currmovenumber " << moveCount + thisThread->PVIdx << sync_endl;
+				<< " currmovenumber " << moveCount << sync_endl;
 
 			if (PvNode)
 				(ss + 1)->pv = nullptr;
@@ -840,18 +1286,28 @@ namespace
 			{
 				// Move count based pruning
 				if (depth < 16 * ONE_PLY
-					&& moveCount >= FutilityMoveCounts[improving][depth])
+					&& orderCount >= FutilityMoveCounts[improving][depth])
+				{
+					if (SpNode)
+						splitPoint->mutex.lock();
+
 					continue;
+				}
 
 				// History based pruning
 				if (depth <= 4 * ONE_PLY
 					&& move != ss->killers[0]
 					&& thisThread->history[pos.moved_piece(move)][to_sq(move)] < VALUE_ZERO
 					&& cmh[pos.moved_piece(move)][to_sq(move)] < VALUE_ZERO)
+				{
+					if (SpNode)
+						splitPoint->mutex.lock();
+
 					continue;
+				}
 
 				//bug fixed predictedDepth = newDepth - reduction<PvNode>(improving, depth, moveCount);
-				predictedDepth = std::max(newDepth - reduction<PvNode>(improving, depth, moveCount), DEPTH_ZERO);
+				predictedDepth = std::max(newDepth - reduction<PvNode>(improving, depth, orderCount), DEPTH_ZERO);
 
 				// Futility pruning: parent node
 				if (predictedDepth < 7 * ONE_PLY)
@@ -861,20 +1317,42 @@ namespace
 					if (futilityValue <= alpha)
 					{
 						bestValue = std::max(bestValue, futilityValue);
+
+						if (SpNode)
+						{
+							splitPoint->mutex.lock();
+							if (bestValue > splitPoint->bestValue)
+								splitPoint->bestValue = bestValue;
+						}
 						continue;
 					}
 				}
 
 				// Prune moves with negative SEE at low depths
 				if (predictedDepth < 4 * ONE_PLY && pos.see_sign(move) < VALUE_ZERO)
+				{
+					if (SpNode)
+						splitPoint->mutex.lock();
+
 					continue;
+				}
 			}
 
-			// Speculative prefetch as early as possible
-			prefetch(TT.first_entry(pos.key_after(move)));
+			// Speculative prefetch as early as possible. With USE_PREFETCH_AHEAD
+			// also for the next move, so that its entries are loaded while this
+			// move is being searched, and not again when it comes.
+#ifdef USE_PREFETCH_AHEAD
+			if (move != prefetched)
+				prefetch_child(pos, move, depth - ONE_PLY);
+
+			if (!SpNode && (prefetched = mp.peek()) != MOVE_NONE)
+				prefetch_child(pos, prefetched, depth - ONE_PLY);
+#else
+			prefetch_child(pos, move, depth - ONE_PLY);
+#endif
 
 			// Check for legality just before making the move
-			if (!RootNode && !pos.legal(move, ci.pinned))
+			if (!RootNode && !SpNode && !pos.legal(move, ci.pinned))
 			{
 				ss->moveCount = --moveCount;
 				continue;
@@ -883,38 +1361,46 @@ namespace
 			ss->currentMove = move;
 			assert(pos.checkers() == pos.in_check(pos.side_to_move()));
 			// Step 14. Make the move
-			pos.do_move(move, st, givesCheck);
-			assert(pos.checkers() == pos.in_check(pos.side_to_move()));
+#ifdef TT_STATS
+			uint64_t nodesBefore = thisThread->nodes;
+#endif
+			Position& next = make_child(pos, child, move, st, givesCheck);
+			assert(next.checkers() == next.in_check(next.side_to_move()));
+			std::atomic<uint64_t>* mark = Abdada && depth >= AbdadaDepth ? Searching.mark(next.key(), depth) : nullptr;
 
 			// Step 15. Reduced depth search (LMR). If the move fails high it will be
 			// re-searched at full depth.
 			if (depth >= 3 * ONE_PLY
-				&&  moveCount > 1
+				&&  orderCount > 1
 				&& !captureOrPromotion)
 			{
-				Depth r = reduction<PvNode>(improving, depth, moveCount);
+				Depth r = reduction<PvNode>(improving, depth, orderCount);
+
+				// Helper threads reduce a bit more or less than the main thread
+				if (r)
+					r = std::max(DEPTH_ZERO, r + thisThread->reductionOffset);
 
 				// Increase reduction for cut nodes and moves with a bad history
 				if ((!PvNode && cutNode)
-					|| (thisThread->history[pos.piece_on(to_sq(move))][to_sq(move)] < VALUE_ZERO
-						&& cmh[pos.piece_on(to_sq(move))][to_sq(move)] <= VALUE_ZERO))
+					|| (thisThread->history[next.piece_on(to_sq(move))][to_sq(move)] < VALUE_ZERO
+						&& cmh[next.piece_on(to_sq(move))][to_sq(move)] <= VALUE_ZERO))
 					r += ONE_PLY;
 
 				// Decrease reduction for moves with a good history
-				if (thisThread->history[pos.piece_on(to_sq(move))][to_sq(move)] > VALUE_ZERO
-					&& cmh[pos.piece_on(to_sq(move))][to_sq(move)] > VALUE_ZERO)
+				if (thisThread->history[next.piece_on(to_sq(move))][to_sq(move)] > VALUE_ZERO
+					&& cmh[next.piece_on(to_sq(move))][to_sq(move)] > VALUE_ZERO)
 					r = std::max(DEPTH_ZERO, r - ONE_PLY);
 
 				// Decrease reduction for moves that escape a capture
 				if (r
 					&& type_of(move) == NORMAL
-					&& type_of(pos.piece_on(to_sq(move))) != PAWN
-					&& pos.see(make_move(to_sq(move), from_sq(move))) < VALUE_ZERO)
+					&& type_of(next.piece_on(to_sq(move))) != PAWN
+					&& next.see(make_move(to_sq(move), from_sq(move))) < VALUE_ZERO)
 					r = std::max(DEPTH_ZERO, r - ONE_PLY);
 
 				Depth d = std::max(newDepth - r, ONE_PLY);
 
-				value = -search<NonPV>(pos, ss + 1, -(alpha + 1), -alpha, d, true);
+				value = -search<NonPV>(next, ss + 1, -(alpha + 1), -alpha, d, true);
 
 				doFullDepthSearch = (value > alpha && r != DEPTH_ZERO);
 			}
@@ -924,9 +1410,9 @@ namespace
 			// Step 16. Full depth search, when LMR is skipped or fails high
 			if (doFullDepthSearch)
 				value = newDepth < ONE_PLY ?
-				givesCheck ? -qsearch<NonPV, true>(pos, ss + 1, -(alpha + 1), -alpha, DEPTH_ZERO)
-				: -qsearch<NonPV, false>(pos, ss + 1, -(alpha + 1), -alpha, DEPTH_ZERO)
-				: -search<NonPV>(pos, ss + 1, -(alpha + 1), -alpha, newDepth, !cutNode);
+				givesCheck ? -qsearch<NonPV, true>(next, ss + 1, -(alpha + 1), -alpha, DEPTH_ZERO)
+				: -qsearch<NonPV, false>(next, ss + 1, -(alpha + 1), -alpha, DEPTH_ZERO)
+				: -search<NonPV>(next, ss + 1, -(alpha + 1), -alpha, newDepth, !cutNode);
 
 			// For PV nodes only, do a full PV search on the first move or after a fail
 			// high (in the latter case search only if value < beta), otherwise let the
@@ -937,21 +1423,32 @@ namespace
 				(ss + 1)->pv[0] = MOVE_NONE;
 
 				value = newDepth < ONE_PLY ?
-					givesCheck ? -qsearch<PV, true>(pos, ss + 1, -beta, -alpha, DEPTH_ZERO)
-					: -qsearch<PV, false>(pos, ss + 1, -beta, -alpha, DEPTH_ZERO)
-					: -search<PV>(pos, ss + 1, -beta, -alpha, newDepth, false);
+					givesCheck ? -qsearch<PV, true>(next, ss + 1, -beta, -alpha, DEPTH_ZERO)
+					: -qsearch<PV, false>(next, ss + 1, -beta, -alpha, DEPTH_ZERO)
+					: -search<PV>(next, ss + 1, -beta, -alpha, newDepth, false);
 			}
 
 			// Step 17. Undo move
-			pos.undo_move(move);
+			unmake_child(pos, move);
+
+			if (mark)
+				mark->store(0, std::memory_order_relaxed);
+			TT_STATS_SUBTREE(newDepth / ONE_PLY, thisThread->nodes - nodesBefore);
 
 			assert(value > -VALUE_INFINITE && value < VALUE_INFINITE);
 
 			// Step 18. Check for new best move
-			// Finished searching the move. If a stop occurred, the return value of
-			// the search cannot be trusted, and we return immediately without
+			if (SpNode)
+			{
+				splitPoint->mutex.lock();
+				bestValue = splitPoint->bestValue;
+				alpha = splitPoint->alpha;
+			}
+
+			// Finished searching the move. If a stop or a cutoff occurred, the return
+			// value of the search cannot be trusted, and we return immediately without
 			// updating best move, PV and TT.
-			if (Signals.stop.load(std::memory_order_relaxed))
+			if (stop_requested(thisThread) || thisThread->cutoff_occurred())
 				return VALUE_ZERO;
 
 			if (RootNode)
@@ -981,11 +1478,24 @@ namespace
 					// not a problem when sorting because the sort is stable and the
 					// move position in the list is preserved - just the PV is pushed up.
 					rm.score = -VALUE_INFINITE;
+
+				// Keep the MultiPV best scores found so far, the last one being
+				// the root alpha in MultiPV mode (see below).
+				if (MultiPV > 1)
+				{
+					std::vector<Value>& scores = thisThread->rootScores;
+
+					scores.insert(std::upper_bound(scores.begin(), scores.end(), value,
+						std::greater<Value>()), value);
+
+					if (scores.size() > MultiPV)
+						scores.pop_back();
+				}
 			}
 
 			if (value > bestValue)
 			{
-				bestValue = value;
+				bestValue = SpNode ? splitPoint->bestValue = value : value;
 
 				if (value > alpha)
 				{
@@ -996,25 +1506,66 @@ namespace
 						&& (move != EasyMove.get(pos.key()) || moveCount > 1))
 						EasyMove.clear();
 
-					bestMove = move;
+					bestMove = SpNode ? splitPoint->bestMove = move : move;
 
 					if (PvNode && !RootNode) // Update pv even in fail-high case
 						update_pv(ss->pv, move, (ss + 1)->pv);
 
 					if (PvNode && value < beta) // Update alpha! Always alpha < beta
-						alpha = value;
-					else
+						alpha = SpNode ? splitPoint->alpha = value
+						: RootNode && MultiPV > 1 ? alpha : value;
+
+					// Fail high. In MultiPV mode the root pass goes on, so that all the
+					// PV lines get a score before the window is widened.
+					else if (!RootNode || MultiPV == 1)
 					{
-						assert(value >= beta); // Fail high
+						assert(value >= beta);
+
+						if (SpNode)
+							splitPoint->cutoff = true;
+
 						break;
 					}
 				}
 			}
 
-			if (!captureOrPromotion && move != bestMove && quietCount < 64)
+			// In MultiPV mode all the PV lines are searched in a single pass: the
+			// root alpha is the score of the last PV line found so far, so that
+			// only the moves entering the PV lines get a full window re-search.
+			if (RootNode && MultiPV > 1 && thisThread->rootScores.size() == MultiPV)
+				alpha = std::max(alpha, thisThread->rootScores.back());
+
+			if (!SpNode && !captureOrPromotion && move != bestMove && quietCount < 64)
 				quietsSearched[quietCount++] = move;
+
+			// Step 19. Check for splitting the search. In YBWC mode, once the first
+			// move is searched, the remaining ones are shared with the idle threads.
+			if (!SpNode
+				&& !RootNode
+				&&  Ybwc
+				&&  depth >= SplitDepth
+				&& (!thisThread->activeSplitPoint
+					|| !thisThread->activeSplitPoint->allSlavesSearching
+					|| (Threads.size() > MAX_SLAVES_PER_SPLITPOINT
+						&& thisThread->activeSplitPoint->slavesMask.count() == MAX_SLAVES_PER_SPLITPOINT))
+				&&  thisThread->splitPointsSize < MAX_SPLITPOINTS_PER_THREAD)
+			{
+				assert(bestValue > -VALUE_INFINITE && bestValue < beta);
+
+				thisThread->split(pos, ss, alpha, beta, &bestValue, &bestMove,
+					depth, moveCount, &mp, NT, cutNode);
+
+				if (stop_requested(thisThread) || thisThread->cutoff_occurred())
+					return VALUE_ZERO;
+
+				if (bestValue >= beta)
+					break;
+			}
 		}
 
+		if (SpNode)
+			return bestValue;
+
 		// Step 20. Check for mate and stalemate
 		// All legal moves have been searched and if there are no legal moves, it
 		// must be mate or stalemate. If we are in a singular extension search then
@@ -1039,17 +1590,22 @@ namespace
 		{
 			Value bonus = Value((depth / ONE_PLY) * (depth / ONE_PLY) + depth / ONE_PLY - 1);
 			Square prevPrevSq = to_sq((ss - 2)->currentMove);
-			CounterMovesStats& prevCmh = CounterMovesHistory[pos.piece_on(prevPrevSq)][prevPrevSq];
+			CounterMovesStats& prevCmh = counter_moves_history(thisThread)[pos.piece_on(prevPrevSq)][prevPrevSq];
 			prevCmh.update(pos.piece_on(prevSq), prevSq, bonus);
 		}
 
 		tte->save(posKey, value_to_tt(bestValue, ss->ply),
 			bestValue >= beta ? BOUND_LOWER :
 			PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER,
-			depth, bestMove, ss->staticEval, TT.generation());
+			depth, tt_move(bestMove, ttMirrored), ss->staticEval, TT.generation());
 
 		assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
+		// In MultiPV mode the root search returns the score of the last PV line,
+		// so that it fails low when that line does.
+		if (RootNode && MultiPV > 1 && bestValue < beta && thisThread->rootScores.size() == MultiPV)
+			return thisThread->rootScores.back();
+
 		return bestValue;
 	}
 
@@ -1070,11 +1626,16 @@ namespace
 
 		Move pv[MAX_PLY + 1];
 		StateInfo st;
+		ChildPosition child;
 		TTEntry* tte;
+		TTEntry ttData; // Entry read from the TT, checked against the key
 		uint64_t posKey;
 		Move ttMove, move, bestMove;
+#ifdef USE_PREFETCH_AHEAD
+		Move prefetched = MOVE_NONE;
+#endif
 		Value bestValue, value, ttValue, futilityValue, futilityBase, oldAlpha;
-		bool ttHit, givesCheck, evasionPrunable;
+		bool ttHit, ttMirrored, givesCheck, evasionPrunable;
 		Depth ttDepth;
 
 		if (PvNode)
@@ -1094,8 +1655,9 @@ namespace
 			return repeat_value(ss->ply, rep);
 		}
 
-		// Check for an instant draw or if the maximum ply has been reached
-		if (pos.is_draw() || ss->ply >= MAX_PLY)
+		// Check for aborted search, an instant draw or if the maximum ply has
+		// been reached
+		if (stop_requested(pos.this_thread()) || pos.is_draw() || ss->ply >= MAX_PLY)
 			return ss->ply >= MAX_PLY && !InCheck ? evaluate(pos)
 			: DrawValue[pos.side_to_move()];
 
@@ -1108,19 +1670,20 @@ namespace
 			: DEPTH_QS_NO_CHECKS;
 
 		// Transposition table lookup
-		posKey = pos.key();
-		tte = TT.probe(posKey, ttHit);
-		ttMove = ttHit ? tte->move() : MOVE_NONE;
-		ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
+		posKey = tt_key(pos, ttMirrored);
+		tte = tt_probe(pos.this_thread(), posKey, ttDepth, ttHit, ttData);
+		ttMove = ttHit ? tt_move(ttData.move(), ttMirrored) : MOVE_NONE;
+		ttValue = ttHit ? value_from_tt(ttData.value(), ss->ply) : VALUE_NONE;
 
 		if (!PvNode
 			&& ttHit
-			&& tte->depth() >= ttDepth
+			&& ttData.depth() >= ttDepth
 			&& ttValue != VALUE_NONE // Only in case of TT access race
-			&& (ttValue >= beta ? (tte->bound() &  BOUND_LOWER)
-				: (tte->bound() &  BOUND_UPPER)))
+			&& (ttValue >= beta ? (ttData.bound() &  BOUND_LOWER)
+				: (ttData.bound() &  BOUND_UPPER)))
 		{
 			ss->currentMove = ttMove; // Can be MOVE_NONE
+			TT_STATS_INC(cutoffs);
 			return ttValue;
 		}
 
@@ -1135,12 +1698,12 @@ namespace
 			if (ttHit)
 			{
 				// Never assume anything on values stored in TT
-				if ((ss->staticEval = bestValue = tte->eval()) == VALUE_NONE)
+				if ((ss->staticEval = bestValue = ttData.eval()) == VALUE_NONE)
 					ss->staticEval = bestValue = evaluate(pos);
 
 				// Can ttValue be used as a better position evaluation?
 				if (ttValue != VALUE_NONE)
-					if (tte->bound() & (ttValue > bestValue ? BOUND_LOWER : BOUND_UPPER))
+					if (ttData.bound() & (ttValue > bestValue ? BOUND_LOWER : BOUND_UPPER))
 						bestValue = ttValue;
 			}
 			else
@@ -1152,7 +1715,7 @@ namespace
 			if (bestValue >= beta)
 			{
 				if (!ttHit)
-					tte->save(pos.key(), value_to_tt(bestValue, ss->ply), BOUND_LOWER,
+					tte->save(posKey, value_to_tt(bestValue, ss->ply), BOUND_LOWER,
 						DEPTH_NONE, MOVE_NONE, ss->staticEval, TT.generation());
 
 				return bestValue;
@@ -1215,8 +1778,16 @@ namespace
 				&& pos.see_sign(move) < VALUE_ZERO)
 				continue;
 
-			// Speculative prefetch as early as possible
-			prefetch(TT.first_entry(pos.key_after(move)));
+			// Speculative prefetch as early as possible, see search()
+#ifdef USE_PREFETCH_AHEAD
+			if (move != prefetched)
+				prefetch_child(pos, move, DEPTH_ZERO);
+
+			if ((prefetched = mp.peek()) != MOVE_NONE)
+				prefetch_child(pos, prefetched, DEPTH_ZERO);
+#else
+			prefetch_child(pos, move, DEPTH_ZERO);
+#endif
 
 			// Check for legality just before making the move
 			if (!pos.legal(move, ci.pinned))
@@ -1225,13 +1796,18 @@ namespace
 			ss->currentMove = move;
 
 			// Make and search the move
-			pos.do_move(move, st, givesCheck);
-			value = givesCheck ? -qsearch<NT, true>(pos, ss + 1, -beta, -alpha, depth - ONE_PLY)
-				: -qsearch<NT, false>(pos, ss + 1, -beta, -alpha, depth - ONE_PLY);
-			pos.undo_move(move);
+			Position& next = make_child(pos, child, move, st, givesCheck);
+			value = givesCheck ? -qsearch<NT, true>(next, ss + 1, -beta, -alpha, depth - ONE_PLY)
+				: -qsearch<NT, false>(next, ss + 1, -beta, -alpha, depth - ONE_PLY);
+			unmake_child(pos, move);
 
 			assert(value > -VALUE_INFINITE && value < VALUE_INFINITE);
 
+			// The value of an aborted search is not reliable, so drop it at once
+			// rather than storing it in the TT
+			if (stop_requested(pos.this_thread()))
+				return VALUE_ZERO;
+
 			// Check for new best move
 			if (value > bestValue)
 			{
@@ -1250,7 +1826,7 @@ namespace
 					else // Fail high
 					{
 						tte->save(posKey, value_to_tt(value, ss->ply), BOUND_LOWER,
-							ttDepth, move, ss->staticEval, TT.generation());
+							ttDepth, tt_move(move, ttMirrored), ss->staticEval, TT.generation());
 
 						return value;
 					}
@@ -1265,7 +1841,7 @@ namespace
 
 		tte->save(posKey, value_to_tt(bestValue, ss->ply),
 			PvNode && bestValue > oldAlpha ? BOUND_EXACT : BOUND_UPPER,
-			ttDepth, bestMove, ss->staticEval, TT.generation());
+			ttDepth, tt_move(bestMove, ttMirrored), ss->staticEval, TT.generation());
 
 		assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -1315,8 +1891,8 @@ namespace
 		Value bonus = Value((depth / ONE_PLY) * (depth / ONE_PLY) + depth / ONE_PLY - 1);
 
 		Square prevSq = to_sq((ss - 1)->currentMove);
-		CounterMovesStats& cmh = CounterMovesHistory[pos.piece_on(prevSq)][prevSq];
 		Thread* thisThread = pos.this_thread();
+		CounterMovesStats& cmh = counter_moves_history(thisThread)[pos.piece_on(prevSq)][prevSq];
 
 		thisThread->history.update(pos.moved_piece(move), to_sq(move), bonus);
 
@@ -1341,36 +1917,62 @@ namespace
 			&& is_ok((ss - 2)->currentMove))
 		{
 			Square prevPrevSq = to_sq((ss - 2)->currentMove);
-			CounterMovesStats& prevCmh = CounterMovesHistory[pos.piece_on(prevPrevSq)][prevPrevSq];
+			CounterMovesStats& prevCmh = counter_moves_history(thisThread)[pos.piece_on(prevPrevSq)][prevPrevSq];
 			prevCmh.update(pos.piece_on(prevSq), prevSq, -bonus - 2 * (depth + 1) / ONE_PLY);
 		}
 	}
 
-	// check_time() is used to print debug info and, more importantly, to detect
-	// when we are out of available time and thus stop the search.
-	void check_time()
-	{
-		static TimePoint lastInfoTime = now();
+} // namespace
 
-		int elapsed = Time.elapsed();
-		TimePoint tick = Limits.startTime + elapsed;
+// Search::check_time() is called by the timer thread to print debug info and,
+// more importantly, to detect when we are out of available time and thus stop
+// the search. Returns the time in ms until the next deadline, when it has to
+// be called again: the maximum time or the movetime, the next debug info, or
+// the polling interval when the deadline cannot be foreseen, as in 'nodes as
+// time' mode or while pondering.
+int Search::check_time()
+{
+	const int PollInterval = 5;
 
-		if (tick - lastInfoTime >= 1000)
-		{
-			lastInfoTime = tick;
-			dbg_print();
-		}
+	static TimePoint lastInfoTime = now(); // Only the timer thread is here
 
-		// An engine may not stop pondering until told so by the GUI
-		if (Limits.ponder)
-			return;
+	int elapsed = Time.elapsed();
+	TimePoint tick = Limits.startTime + elapsed;
 
-		if ((Limits.use_time_management() && elapsed > Time.maximum() - 10)
-			|| (Limits.movetime && elapsed >= Limits.movetime)
-			|| (Limits.nodes && Threads.nodes_searched() >= Limits.nodes))
-			Signals.stop = true;
+	TT.sync_generation();
+
+	if (tick - lastInfoTime >= 1000)
+	{
+		lastInfoTime = tick;
+		dbg_print();
+
+#ifdef TT_STATS
+		if (Options["TT Stats"])
+			sync_cout << "info string " << Threads.tt_stats() << sync_endl;
+#endif
 	}
-} // namespace
+
+	int next = int(lastInfoTime + 1000 - tick);
+
+	// An engine may not stop pondering until told so by the GUI
+	if (Limits.ponder)
+		return std::min(next, PollInterval);
+
+	if ((Limits.use_time_management() && elapsed > Time.maximum() - 10)
+		|| (Limits.movetime && elapsed >= Limits.movetime))
+		request_stop();
+
+	if (Limits.use_time_management())
+		next = std::min(next, Time.maximum() - 10 - elapsed);
+
+	if (Limits.movetime)
+		next = std::min(next, Limits.movetime - elapsed);
+
+	if (Limits.npmsec) // Time.elapsed() counts the nodes with npmsec
+		next = std::min(next, PollInterval);
+
+	return std::max(next, 1);
+}
 
 // UCI::pv() formats PV information according to the UCI protocol. UCI requires
 // that all (if any) unsearched PV lines are sent using a previous search score.
@@ -1379,20 +1981,21 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta)
 	std::stringstream ss;
 	int elapsed = Time.elapsed() + 1;
 	const Search::RootMoveVector& rootMoves = pos.this_thread()->rootMoves;
-	size_t PVIdx = pos.this_thread()->PVIdx;
 	size_t multiPV = std::min((size_t)Options["MultiPV"], rootMoves.size());
 	uint64_t nodes_searched = Threads.nodes_searched();
 
 	for (size_t i = 0; i < multiPV; i++)
 	{
-		bool updated = (i <= PVIdx);
-
-		if (depth == ONE_PLY && !updated)
-			continue;
+		// A line not searched by the last pass, or failed low, is shown with
+		// the score of the previous iteration, if any.
+		bool updated = rootMoves[i].score != -VALUE_INFINITE;
 
 		Depth d = updated ? depth : depth - ONE_PLY;
 		Value v = updated ? rootMoves[i].score : rootMoves[i].previousScore;
 
+		if (d < ONE_PLY || v == -VALUE_INFINITE)
+			continue;
+
 		bool tb = TB::RootInTB && abs(v) < VALUE_MATE - MAX_PLY;
 		v = tb ? TB::Score : v;
 
@@ -1405,7 +2008,7 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta)
 			<< " multipv " << i + 1
 			<< " score " << UCI::value(v);
 
-		if (!tb && i == PVIdx)
+		if (!tb && updated)
 			ss << (v >= beta ? " lowerbound" : v <= alpha ? " upperbound" : "");
 
 		ss << " nodes " << nodes_searched
@@ -1431,17 +2034,19 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta)
 void RootMove::insert_pv_in_tt(Position& pos)
 {
 	StateInfo state[MAX_PLY], *st = state;
-	bool ttHit;
+	TTEntry ttData;
+	bool ttHit, ttMirrored;
 
 	for (Move m : pv)
 	{
 		assert(MoveList<LEGAL>(pos).contains(m));
 
-		TTEntry* tte = TT.probe(pos.key(), ttHit);
+		uint64_t posKey = tt_key(pos, ttMirrored);
+		TTEntry* tte = tt_probe(pos.this_thread(), posKey, DEPTH_MAX, ttHit, ttData);
 
-		if (!ttHit || tte->move() != m) // Don't overwrite correct entries
-			tte->save(pos.key(), VALUE_NONE, BOUND_NONE, DEPTH_NONE,
-				m, VALUE_NONE, TT.generation());
+		if (!ttHit || ttData.move() != tt_move(m, ttMirrored)) // Don't overwrite correct entries
+			tte->save(posKey, VALUE_NONE, BOUND_NONE, DEPTH_NONE,
+				tt_move(m, ttMirrored), VALUE_NONE, TT.generation());
 
 		pos.do_move(m, *st++, pos.gives_check(m, CheckInfo(pos)));
 	}
@@ -1457,17 +2062,18 @@ void RootMove::insert_pv_in_tt(Position& pos)
 bool RootMove::extract_ponder_from_tt(Position& pos)
 {
 	StateInfo st;
-	bool ttHit;
+	TTEntry ttData;
+	bool ttHit, ttMirrored;
 
 	assert(pv.size() == 1);
 
 	pos.do_move(pv[0], st, pos.gives_check(pv[0], CheckInfo(pos)));
-	TTEntry* tte = TT.probe(pos.key(), ttHit);
+	TT.probe(tt_key(pos, ttMirrored), ttHit, ttData);
 	pos.undo_move(pv[0]);
 
 	if (ttHit)
 	{
-		Move m = tte->move(); // Local copy to be SMP safe
+		Move m = tt_move(ttData.move(), ttMirrored);
 		if (MoveList<LEGAL>(pos).contains(m))
 			return pv.push_back(m), true;
 	}
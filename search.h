@@ -23,15 +23,18 @@
 #ifndef SEARCH_H_INCLUDED
 #define SEARCH_H_INCLUDED
 
+#include <algorithm>
 #include <atomic>
-#include <memory>  // For std::unique_ptr
-#include <stack>
+#include <deque>
+#include <ostream>
 #include <vector>
 
 #include "misc.h"
 #include "position.h"
 #include "types.h"
 
+struct SplitPoint;
+
 namespace Search
 {
 	// Stack struct keeps track of the information we need to remember from nodes
@@ -39,6 +42,7 @@ namespace Search
 	// its own array of Stack objects, indexed by the current ply.
 	struct Stack
 	{
+		SplitPoint* splitPoint;
 		Move* pv;
 		int ply;
 		Move currentMove;
@@ -94,16 +98,47 @@ namespace Search
 	struct SignalsType
 	{
 		std::atomic_bool stop, stopOnPonderhit;
+		std::atomic<TimePoint> stopTime; // When the stop was requested, 0 if not yet
+	};
+
+	// StopLatency struct is the histogram of the time taken to send the best
+	// move once the stop has been requested, by the GUI or by the time limits,
+	// in buckets of 0, 1, 2-3, 4-7 and so on milliseconds up to 1024 or more.
+	// Only the main thread updates it, when sending the best move.
+	struct StopLatency
+	{
+		static const int Buckets = 12;
+
+		void clear() { std::fill(count, count + Buckets, 0), maxLatency = 0; }
+		void add(TimePoint ms);
+
+		uint64_t count[Buckets];
+		TimePoint maxLatency;
 	};
 
-	typedef std::unique_ptr<std::stack<StateInfo>> StateStackPtr;
+	std::ostream& operator<<(std::ostream& os, const StopLatency& h);
+
+	// StateArena keeps the states of the moves played from the root FEN up to
+	// the position the search starts from, as needed by repetition detection.
+	// A deque grows without moving the states already linked by Position, so
+	// a new 'position' command can extend the list however long the game.
+	struct StateArena
+	{
+		void clear() { states.clear(); }
+		StateInfo& push() { states.emplace_back(); return states.back(); }
+
+		std::deque<StateInfo> states;
+	};
 
 	extern SignalsType Signals;
 	extern LimitsType Limits;
-	extern StateStackPtr SetupStates;
+	extern StateArena SetupStates;
+	extern StopLatency StopLatencies;
 
 	void init();
 	void clear();
+	void request_stop();
+	int check_time();
 	template<bool Root = true> uint64_t perft(Position& pos, Depth depth);
 
 } // namespace Search
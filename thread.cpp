@@ -24,8 +24,10 @@
 #include <cassert>
 
 #include "movegen.h"
+#include "numa.h"
 #include "search.h"
 #include "thread.h"
+#include "tt.h"
 #include "uci.h"
 
 using namespace Search;
@@ -36,10 +38,18 @@ ThreadPool Threads; // Global object
 // in idle_loop().
 Thread::Thread()
 {
-	resetCalls = exit = false;
-	maxPly = callsCnt = 0;
+	exit = false;
+	job = nullptr;
+	activeSplitPoint = waitingSplitPoint = helpSplitPoint = nullptr;
+	splitPointsSize = 0;
+	maxPly = 0;
+	nodes = nodeBudget = 0;
+#ifdef TT_STATS
+	ttStats.clear();
+#endif
 	history.clear();
 	counterMoves.clear();
+	hotTable.clear();
 	idx = Threads.size(); // Start from 0
 
 	std::unique_lock<Mutex> lk(mutex);
@@ -83,9 +93,237 @@ void Thread::start_searching(bool resume)
 	sleepCondition.notify_one();
 }
 
+// Thread::start_job() wake up the thread that will run the given job, e.g.
+// clear its tables, instead of a search
+void Thread::start_job(void (Thread::*j)())
+{
+	std::unique_lock<Mutex> lk(mutex);
+
+	job = j;
+	searching = true;
+	sleepCondition.notify_one();
+}
+
+// Thread::book() books a sleeping thread as a slave of the given split point
+// and wakes it up. A master waiting for its slaves is booked too, but only at
+// the split points they create below its own. Returns false if the thread is
+// busy.
+bool Thread::book(SplitPoint* sp)
+{
+	std::unique_lock<Mutex> lk(mutex);
+
+	if (exit)
+		return false;
+
+	if (searching)
+	{
+		if (!waitingSplitPoint || helpSplitPoint)
+			return false;
+
+		const SplitPoint* p = sp->parentSplitPoint;
+
+		while (p && p != waitingSplitPoint)
+			p = p->parentSplitPoint;
+
+		if (!p)
+			return false;
+
+		helpSplitPoint = sp;
+		sleepCondition.notify_all(); // The master may share it with a waiter
+		return true;
+	}
+
+	activeSplitPoint = sp;
+	searching = true;
+	sleepCondition.notify_one();
+	return true;
+}
+
+// Thread::late_join() books the thread as a slave of a split point where all
+// the slaves are still busy and there is room for one more, looking first at
+// the split points nearest the root of each thread. When an ancestor is given
+// only its descendants are considered: a master waiting for its slaves helps
+// them below its own split point, but nowhere else. Returns the split point
+// joined, if any.
+SplitPoint* Thread::late_join(const SplitPoint* ancestor)
+{
+	for (Thread* th : Threads)
+		for (size_t i = 0; i < th->splitPointsSize; ++i)
+		{
+			SplitPoint* sp = &th->splitPoints[i];
+
+			if (!sp->allSlavesSearching)
+				continue;
+
+			// The split point could have been finished and reused meanwhile, so
+			// check again under lock protection
+			sp->mutex.lock();
+
+			bool joinable = sp->allSlavesSearching
+				&& !sp->cutoff
+				&& sp->slavesMask.count() < MAX_SLAVES_PER_SPLITPOINT;
+
+			if (joinable && ancestor)
+			{
+				const SplitPoint* p = sp->parentSplitPoint;
+
+				while (p && p != ancestor)
+					p = p->parentSplitPoint;
+
+				joinable = p == ancestor;
+			}
+
+			if (joinable)
+			{
+				sp->slavesMask.set(idx);
+				sp->mutex.unlock();
+				return sp;
+			}
+
+			sp->mutex.unlock();
+		}
+
+	return nullptr;
+}
+
+// Thread::split() does the actual work of distributing the work at a node
+// between several available threads. If it does not succeed in splitting the
+// node (because no idle threads are available), the function immediately
+// returns. If splitting is possible, a SplitPoint object is initialized with
+// all the data that must be copied to the helper threads and then helper
+// threads are informed that they have been assigned work. The master searches
+// the split point too, then helps its slaves below it until they are all
+// finished, and the best move and value found are copied back.
+void Thread::split(Position& pos, Stack* ss, Value alpha, Value beta, Value* bestValue, Move* bestMove,
+	Depth depth, int moveCount, MovePicker* movePicker, int nodeType, bool cutNode)
+{
+	assert(-VALUE_INFINITE < *bestValue && *bestValue <= alpha && alpha < beta && beta <= VALUE_INFINITE);
+	assert(splitPointsSize < MAX_SPLITPOINTS_PER_THREAD);
+
+	// Pick and init the next available split point
+	SplitPoint& sp = splitPoints[splitPointsSize];
+
+	sp.mutex.lock(); // Booked only once splitPointsSize is incremented
+
+	sp.master = this;
+	sp.parentSplitPoint = activeSplitPoint;
+	sp.slavesMask = 0, sp.slavesMask.set(idx);
+	sp.depth = depth;
+	sp.bestValue = *bestValue;
+	sp.bestMove = *bestMove;
+	sp.alpha = alpha;
+	sp.beta = beta;
+	sp.nodeType = nodeType;
+	sp.cutNode = cutNode;
+	sp.movePicker = movePicker;
+	sp.moveCount = moveCount;
+	sp.pos = &pos;
+	sp.ss = ss;
+	sp.cutoff = false;
+	sp.allSlavesSearching = true; // Must be set under lock protection
+
+	++splitPointsSize;
+	activeSplitPoint = &sp;
+
+	// Try to allocate the sleeping threads
+	for (Thread* th : Threads)
+		if (sp.slavesMask.count() < MAX_SLAVES_PER_SPLITPOINT && th->book(&sp))
+			sp.slavesMask.set(th->idx);
+
+	// No idle thread, the master goes on searching the node alone
+	if (sp.slavesMask.count() == 1)
+	{
+		sp.allSlavesSearching = false;
+		--splitPointsSize;
+		activeSplitPoint = sp.parentSplitPoint;
+		sp.mutex.unlock();
+		return;
+	}
+
+	sp.mutex.unlock();
+
+	// Everything is set up. The master searches the split point like its
+	// slaves, on a copy of the position, because 'pos' must be left untouched
+	// for the move picker. Then, rather than waiting idle, it helps the slaves
+	// still searching, at the split points they have created below this one.
+	// When there is none to join it sleeps until the last slave leaves, or
+	// until a slave books it at a new split point.
+	search_split_point(&sp);
+
+	while (true)
+	{
+		SplitPoint* helped = late_join(&sp);
+
+		if (!helped)
+		{
+			std::unique_lock<Mutex> lk(mutex);
+
+			waitingSplitPoint = &sp;
+			sleepCondition.wait(lk, [&] {
+				std::unique_lock<Mutex> spLock(sp.mutex);
+				return helpSplitPoint || sp.slavesMask.none();
+			});
+			waitingSplitPoint = nullptr;
+			helped = helpSplitPoint;
+			helpSplitPoint = nullptr;
+		}
+
+		if (!helped)
+			break;
+
+		search_split_point(helped);
+	}
+
+	// All the threads are finished, the split point is not accessed anymore
+	--splitPointsSize;
+	activeSplitPoint = sp.parentSplitPoint;
+	*bestMove = sp.bestMove;
+	*bestValue = sp.bestValue;
+}
+
+// Thread::cutoff_occurred() checks whether a beta cutoff has occurred in the
+// current active split point, or in some ancestor of the split point.
+bool Thread::cutoff_occurred() const
+{
+	for (SplitPoint* sp = activeSplitPoint; sp; sp = sp->parentSplitPoint)
+		if (sp->cutoff)
+			return true;
+
+	return false;
+}
+
+// Thread::clear() resets the thread's own tables and zeroes its slice of the
+// TT. Run by each thread on itself, so the pages it touches first are local
+// to the node the thread is bound to.
+void Thread::clear()
+{
+	history.clear();
+	counterMoves.clear();
+	hotTable.clear();
+	TT.clear(idx, Threads.size());
+
+	if (counterMovesHistory)
+		counterMovesHistory->clear();
+#ifdef TT_STATS
+	ttStats.clear();
+#endif
+}
+
+// Thread::rehash() moves the entries of the old TT into its slice of the new
+// one while the TT is resized, see TranspositionTable::resize().
+void Thread::rehash()
+{
+	TT.rehash(idx, Threads.size());
+}
+
 // Thread::idle_loop() is where the thread is parked when it has no work to do
 void Thread::idle_loop()
 {
+	Numa::bind_this_thread(idx);
+#ifdef TT_STATS
+	ThreadTTStats = &ttStats;
+#endif
+
 	while (!exit)
 	{
 		std::unique_lock<Mutex> lk(mutex);
@@ -100,17 +338,83 @@ void Thread::idle_loop()
 
 		lk.unlock();
 
-		if (!exit)
+		if (exit)
+			break;
+
+		if (job)
+		{
+			(this->*job)();
+			job = nullptr;
+		}
+
+		// Booked as a slave of a split point: once finished there, the thread
+		// tries to late join another split point before going back to sleep
+		else if (activeSplitPoint)
+		{
+			SplitPoint* sp = activeSplitPoint;
+			activeSplitPoint = nullptr;
+
+			do
+				search_split_point(sp);
+			while ((sp = late_join(nullptr)) != nullptr);
+		}
+
+		else
 			search();
 	}
 }
 
+// TimerThread constructor launches the thread, that sleeps in idle_loop()
+// until a search is started
+TimerThread::TimerThread()
+{
+	exit = running = false;
+	nativeThread = std::thread(&TimerThread::idle_loop, this);
+}
+
+// TimerThread destructor wait for thread termination before returning
+TimerThread::~TimerThread()
+{
+	mutex.lock();
+	exit = true;
+	sleepCondition.notify_one();
+	mutex.unlock();
+	nativeThread.join();
+}
+
+// TimerThread::run() starts or stops checking the limits of the search. When
+// stopping, it returns only once check_time() is not running anymore, so
+// that it cannot stop the next search.
+void TimerThread::run(bool on)
+{
+	std::unique_lock<Mutex> lk(mutex);
+
+	running = on;
+	sleepCondition.notify_one();
+}
+
+// TimerThread::idle_loop() calls check_time() while a search is running and
+// then sleeps until the time it returns, otherwise until woken up
+void TimerThread::idle_loop()
+{
+	std::unique_lock<Mutex> lk(mutex);
+
+	while (!exit)
+	{
+		if (running)
+			sleepCondition.wait_for(lk, std::chrono::milliseconds(check_time()));
+		else
+			sleepCondition.wait(lk);
+	}
+}
+
 // ThreadPool::init() create and launch requested threads, that will go
 // immediately to sleep. We cannot use a constructor because Threads is a
 // static object and we need a fully initialized engine at this point due to
 // allocation of Endgames in the Thread constructor.
 void ThreadPool::init()
 {
+	timer = new TimerThread;
 	push_back(new MainThread);
 	read_uci_options();
 }
@@ -120,6 +424,8 @@ void ThreadPool::init()
 // static objects, so while still in main().
 void ThreadPool::exit()
 {
+	delete timer;
+
 	while (size())
 		delete back(), pop_back();
 }
@@ -140,30 +446,94 @@ void ThreadPool::read_uci_options()
 		delete back(), pop_back();
 }
 
+// ThreadPool::run() has all the threads run the given job in parallel, e.g.
+// clear their tables, and waits for them to finish, so that a following
+// "isready" is answered only once the job completes.
+void ThreadPool::run(void (Thread::*job)())
+{
+	main()->wait_for_search_finished();
+
+	for (Thread* th : *this)
+		th->start_job(job);
+
+	for (Thread* th : *this)
+		th->wait_for_search_finished();
+}
+
+// ThreadPool::start_sync() sets up the barrier of the deterministic mode for
+// a new search, see ThreadPool::sync().
+void ThreadPool::start_sync()
+{
+	syncThreads = size();
+	syncArrived = 0;
+	syncRound = 0;
+}
+
+// ThreadPool::sync() is where the threads meet before each iteration in the
+// deterministic mode. The last thread to arrive writes the TT entries buffered
+// by all the threads during the previous iterations, in thread index order, and
+// then releases the others. A thread leaving the search arrives for the last
+// time and does not wait.
+void ThreadPool::sync(bool leave)
+{
+	std::unique_lock<Mutex> lk(syncMutex);
+	uint64_t round = syncRound;
+
+	if (leave)
+		--syncThreads;
+	else
+		++syncArrived;
+
+	if (syncArrived == syncThreads)
+	{
+		for (Thread* th : *this)
+			th->ttBuffer.flush();
+
+		syncArrived = 0;
+		++syncRound;
+		syncCondition.notify_all();
+	}
+	else if (!leave)
+		syncCondition.wait(lk, [&] { return syncRound != round; });
+}
+
 // ThreadPool::nodes_searched() return the number of nodes searched
 int64_t ThreadPool::nodes_searched()
 {
 	int64_t nodes = 0;
 	for (Thread* th : *this)
-		nodes += th->rootPos.nodes_searched();
+		nodes += th->nodes;
 	return nodes;
 }
 
+#ifdef TT_STATS
+// ThreadPool::tt_stats() returns the TT counters summed over all the threads
+TTStats ThreadPool::tt_stats()
+{
+	TTStats stats;
+	stats.clear();
+
+	for (Thread* th : *this)
+		stats += th->ttStats;
+
+	return stats;
+}
+#endif
+
 // ThreadPool::start_thinking() wake up the main thread sleeping in idle_loop()
 // and start a new search, then return immediately.
-void ThreadPool::start_thinking(const Position& pos, const LimitsType& limits,
-	StateStackPtr& states)
+void ThreadPool::start_thinking(const Position& pos, const LimitsType& limits)
 {
 	main()->wait_for_search_finished();
 	Signals.stopOnPonderhit = Signals.stop = false;
+	Signals.stopTime = 0;
 	main()->rootMoves.clear();
 	main()->rootPos = pos;
+
+	for (Thread* th : *this)
+		th->nodes = 0;
+
 	Limits = limits;
-	if (states.get()) // If we don't set a new position, preserve current state
-	{
-		SetupStates = std::move(states); // Ownership transfer here
-		assert(!states.get());
-	}
 
 	for (const auto& m : MoveList<LEGAL>(pos))
 		if (limits.searchmoves.empty()
@@ -26,6 +26,7 @@
 #include <atomic>
 #include <bitset>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -36,6 +37,40 @@
 #include "position.h"
 #include "search.h"
 #include "thread_win32.h"
+#include "tt.h"
+
+const size_t MAX_SPLITPOINTS_PER_THREAD = 8;
+const size_t MAX_SLAVES_PER_SPLITPOINT = 4;
+
+class Thread;
+
+// SplitPoint struct stores information shared by the threads searching in
+// parallel below the same node, in the Young Brothers Wait Concept mode
+// selected with the "YBWC" option. The shared data is protected by the mutex.
+struct SplitPoint
+{
+	// Const data after split point has been setup
+	const Position* pos;
+	Search::Stack* ss;
+	Thread* master;
+	Depth depth;
+	Value beta;
+	int nodeType;
+	bool cutNode;
+
+	// Const pointers to shared data
+	MovePicker* movePicker;
+	SplitPoint* parentSplitPoint;
+
+	// Shared variable data
+	Mutex mutex;
+	std::bitset<MAX_THREAD_COUNT> slavesMask;
+	std::atomic_bool allSlavesSearching, cutoff;
+	Value alpha;
+	Value bestValue;
+	Move bestMove;
+	int moveCount;
+};
 
 // Thread struct keeps together all the thread related stuff. We also use
 // per-thread pawn and material hash tables so that once we get a pointer to an
@@ -47,6 +82,7 @@ class Thread
 	Mutex mutex;
 	ConditionVariable sleepCondition;
 	bool exit, searching;
+	void (Thread::*job)(); // Run instead of a search when set
 
 public:
 	Thread();
@@ -54,22 +90,44 @@ public:
 	virtual void search();
 	void idle_loop();
 	void start_searching(bool resume = false);
+	void start_job(void (Thread::*j)());
+	bool book(SplitPoint* sp);
+	SplitPoint* late_join(const SplitPoint* ancestor);
+	void search_split_point(SplitPoint* sp);
+	void split(Position& pos, Search::Stack* ss, Value alpha, Value beta, Value* bestValue, Move* bestMove,
+		Depth depth, int moveCount, MovePicker* movePicker, int nodeType, bool cutNode);
+	bool cutoff_occurred() const;
+	void clear();
+	void rehash();
 	void wait_for_search_finished();
 	void wait(std::atomic_bool& b);
 
 	Pawns::Table pawnsTable;
+	HotTable hotTable;
+	TTBuffer ttBuffer;
 	Material::Table materialTable;
 	Endgames endgames;
-	size_t idx, PVIdx;
-	int maxPly, callsCnt;
+	size_t idx;
+	int maxPly;
+	uint64_t nodes, nodeBudget;
+#ifdef TT_STATS
+	TTStats ttStats;
+#endif
 
 	Position rootPos;
 	Search::RootMoveVector rootMoves;
+	std::vector<Value> rootScores; // Best root move scores, in MultiPV mode
 	Depth rootDepth;
 	HistoryStats history;
 	MovesStats counterMoves;
+	std::unique_ptr<CounterMovesHistoryStats> counterMovesHistory; // Deterministic mode only
 	Depth completedDepth;
-	std::atomic_bool resetCalls;
+	Depth reductionOffset; // LMR diversity of the helper threads
+	SplitPoint splitPoints[MAX_SPLITPOINTS_PER_THREAD];
+	SplitPoint* activeSplitPoint;
+	SplitPoint* waitingSplitPoint; // Own split point whose slaves the master is waiting for
+	SplitPoint* helpSplitPoint; // Booked below waitingSplitPoint while waiting
+	std::atomic<size_t> splitPointsSize;
 };
 
 // MainThread is a derived class with a specific overload for the main thread
@@ -81,6 +139,25 @@ struct MainThread : public Thread
 	double bestMoveChanges;
 };
 
+// TimerThread checks the limits of the search and prints the periodic debug
+// info, see check_time(), while a search is running. It sleeps until the next
+// deadline rather than being polled by the search threads, so that the stop
+// latency does not depend on how fast they are going through the nodes.
+class TimerThread
+{
+	std::thread nativeThread;
+	Mutex mutex;
+	ConditionVariable sleepCondition;
+	bool exit, running;
+
+	void idle_loop();
+
+public:
+	TimerThread();
+	~TimerThread();
+	void run(bool on);
+};
+
 // ThreadPool struct handles all the threads related stuff like init, starting,
 // parking and, most importantly, launching a thread. All the access to threads
 // data is done through this class.
@@ -90,9 +167,25 @@ struct ThreadPool : public std::vector<Thread*>
 	void exit(); // be initialized and valid during the whole thread lifetime.
 
 	MainThread* main() { return static_cast<MainThread*>(at(0)); }
-	void start_thinking(const Position&, const Search::LimitsType&, Search::StateStackPtr&);
+	void start_thinking(const Position&, const Search::LimitsType&);
 	void read_uci_options();
+	void run(void (Thread::*job)());
+	void clear() { run(&Thread::clear); }
+	void rehash() { run(&Thread::rehash); }
+	void start_sync();
+	void sync(bool leave = false);
 	int64_t nodes_searched();
+#ifdef TT_STATS
+	TTStats tt_stats();
+#endif
+
+	TimerThread* timer;
+
+private:
+	Mutex syncMutex;
+	ConditionVariable syncCondition;
+	size_t syncThreads, syncArrived;
+	uint64_t syncRound;
 };
 
 extern ThreadPool Threads;
@@ -20,65 +20,745 @@
   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>   // For std::memset
+#include <fstream>
 #include <iostream>
+#include <thread>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "init.h"
+#include "numa.h"
+#include "thread.h"
 #include "tt.h"
 
 TranspositionTable TT; // Our global transposition table
 
+namespace
+{
+	const char Magic[8] = "CHMTT01";
+
+#ifdef USE_WIDE_TT
+	const uint32_t KeyBits = 32;
+#else
+	const uint32_t KeyBits = 16;
+#endif
+
+	// File backed tables start one page after the header, to keep the table
+	// aligned whatever the header size.
+	const size_t HeaderSize = 4096;
+
+	// less() returns whether a * b < c * d, comparing the 128 bit products
+	bool less(uint64_t a, uint64_t b, uint64_t c, uint64_t d)
+	{
+		uint64_t hi1 = mul_hi64(a, b), hi2 = mul_hi64(c, d);
+
+		return hi1 < hi2 || (hi1 == hi2 && a * b < c * d);
+	}
+
+	// scale() returns i * to / from rounded down, or up if 'up' is set. The
+	// floating point estimate is off by one at most and is fixed exactly.
+	uint64_t scale(uint64_t i, uint64_t to, uint64_t from, bool up)
+	{
+		uint64_t q = uint64_t(double(i) * double(to) / double(from));
+
+		while (q && less(i, to, q, from))
+			--q;
+
+		while (!less(i, to, q + 1, from))
+			++q;
+
+		return q + (up && less(q, from, i, to));
+	}
+
+	// madvise() only asks for transparent huge pages, the kernel backs the
+	// table with them, or not, when the pages are first touched.
+	const char* ThpRequested = "4KB pages, transparent huge pages requested";
+
+#if defined(__linux__)
+	// huge_kb() returns the AnonHugePages field of /proc/self/smaps for the
+	// mapping holding 'addr', the amount of it really backed by huge pages.
+	size_t huge_kb(const void* addr)
+	{
+		std::ifstream smaps("/proc/self/smaps");
+		std::string line;
+		bool inside = false;
+
+		while (std::getline(smaps, line))
+		{
+			unsigned long begin, end;
+
+			if (std::sscanf(line.c_str(), "%lx-%lx ", &begin, &end) == 2)
+				inside = uintptr_t(addr) >= begin && uintptr_t(addr) < end;
+
+			else if (inside && !line.compare(0, 14, "AnonHugePages:"))
+				return std::strtoull(line.c_str() + 14, nullptr, 10);
+		}
+
+		return 0;
+	}
+#endif
+
+} // namespace
+
+TranspositionTable::Header TranspositionTable::header() const
+{
+	static_assert(sizeof(Header) <= HeaderSize, "Header too big");
+
+	Header h;
+	std::memcpy(h.magic, Magic, sizeof(Magic));
+	h.entrySize = sizeof(TTEntry);
+	h.clusterSize = ClusterSize;
+	h.clusterBytes = sizeof(Cluster);
+	h.keyBits = KeyBits;
+	h.clusterCount = clusterCount;
+	h.generation = generation8;
+	h.processes = 0;
+	return h;
+}
+
+bool TranspositionTable::compatible(const Header& h) const
+{
+	Header ours = header();
+
+	return   !std::memcmp(h.magic, ours.magic, sizeof(Magic))
+		&& h.entrySize == ours.entrySize
+		&& h.clusterSize == ours.clusterSize
+		&& h.clusterBytes == ours.clusterBytes
+		&& h.keyBits == ours.keyBits;
+}
+
+#ifdef TT_STATS
+namespace { TTStats OtherStats; } // Shared by the threads that don't search
+
+thread_local TTStats* ThreadTTStats = &OtherStats;
+
+TTStats& TTStats::operator+=(const TTStats& s)
+{
+	const uint64_t* src = (const uint64_t*)&s;
+	uint64_t* dst = (uint64_t*)this;
+
+	for (size_t i = 0; i < sizeof(TTStats) / sizeof(uint64_t); ++i)
+		dst[i] += src[i];
+
+	return *this;
+}
+
+// operator<<(TTStats) prints the counters on a single line, as percentages
+// of the probes or of the writes where it makes sense.
+std::ostream& operator<<(std::ostream& os, const TTStats& s)
+{
+	auto pct = [](uint64_t n, uint64_t total) { return total ? int(10000.0 * n / total + 0.5) / 100.0 : 0.0; };
+	uint64_t writes = s.emptyWrites + s.sameKeyWrites + s.replaceWrites;
+
+	os << "tt probes " << s.probes
+		<< " hits " << pct(s.hits, s.probes) << "%"
+		<< " (none " << s.hitsByBound[BOUND_NONE]
+		<< " upper " << s.hitsByBound[BOUND_UPPER]
+		<< " lower " << s.hitsByBound[BOUND_LOWER]
+		<< " exact " << s.hitsByBound[BOUND_EXACT] << ")"
+		<< " cutoffs " << pct(s.cutoffs, s.probes) << "%"
+		<< " writes " << writes
+		<< " (empty " << pct(s.emptyWrites, writes) << "%"
+		<< " same " << pct(s.sameKeyWrites, writes) << "%"
+		<< " replace " << pct(s.replaceWrites, writes) << "%)"
+		<< " victims age";
+
+	for (uint64_t n : s.victimsByAge)
+		os << " " << n;
+
+	os << " depth";
+
+	for (uint64_t n : s.victimsByDepth)
+		os << " " << n;
+
+	os << " etc probes " << s.etcProbes
+		<< " cutoffs " << s.etcCutoffs
+		<< " nodes saved ~" << s.etcNodesSaved;
+
+	return os;
+}
+#endif
+
+// TranspositionTable::allocate() gets 'size' bytes of zeroed, cache line
+// aligned memory for the table and returns the kind of pages backing it. On
+// Linux the table is mapped, so that pages are committed only when first
+// touched, and backed by huge pages when available to spare TLB misses:
+// explicit ones from the hugetlbfs pool first, then transparent huge pages.
+// Elsewhere it falls back to calloc. When a backing file is set (Linux only)
+// the table is a shared mapping of that file instead, and the entries found
+// in the file are kept if the file holds a table of the same size and format.
+const char* TranspositionTable::allocate(size_t size)
+{
+	shared = false;
+
+#if defined(__linux__)
+	const size_t HugePageSize = 2 * 1024 * 1024;
+
+	if (!backingFile.empty() && segment)
+		return attach(size);
+
+	if (!backingFile.empty())
+	{
+		int fd = open(backingFile.c_str(), O_RDWR | O_CREAT, 0644);
+		Header h;
+
+		if (fd == -1)
+			return nullptr;
+
+		bool reuse =   pread(fd, &h, sizeof(h), 0) == sizeof(h)
+					&& compatible(h)
+					&& h.clusterCount == clusterCount;
+
+		memSize = HeaderSize + size;
+
+		if (!reuse && ftruncate(fd, 0)) // Zero the old contents
+			return close(fd), nullptr;
+
+		if (ftruncate(fd, memSize))
+			return close(fd), nullptr;
+
+		mem = mmap(nullptr, memSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (mem == MAP_FAILED)
+		{
+			mem = nullptr;
+			return nullptr;
+		}
+
+		mapped = shared = true;
+		table = (Cluster*)((char*)mem + HeaderSize);
+		generation8 = reuse ? h.generation : generation8;
+		return reuse ? "a file mapping, entries restored" : "a file mapping";
+	}
+
+	memSize = (size + HugePageSize - 1) & ~(HugePageSize - 1);
+	mem = mmap(nullptr, memSize, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+	if (mem != MAP_FAILED)
+	{
+		mapped = true;
+		table = (Cluster*)mem;
+		Numa::interleave(mem, memSize);
+		return "2MB huge pages";
+	}
+
+	// Map one more huge page so that the table can start on a huge page
+	// boundary, where the kernel can back it with transparent huge pages.
+	memSize += HugePageSize;
+	mem = mmap(nullptr, memSize, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (mem != MAP_FAILED)
+	{
+		mapped = true;
+		table = (Cluster*)((uintptr_t(mem) + HugePageSize - 1) & ~(HugePageSize - 1));
+		Numa::interleave(mem, memSize);
+
+#if defined(MADV_HUGEPAGE)
+		if (!madvise(table, size, MADV_HUGEPAGE))
+			return ThpRequested;
+#endif
+		return "4KB pages";
+	}
+#endif
+
+	mapped = false;
+	memSize = size + CacheLineSize - 1;
+	mem = calloc(memSize, 1);
+
+	if (!mem)
+		return nullptr;
+
+	table = (Cluster*)((uintptr_t(mem) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+	return "default pages";
+}
+
+// TranspositionTable::attach() maps the table from the POSIX shared memory
+// segment named by backingFile, so that several engine processes share their
+// entries. The first process creates the segment and the others attach to
+// it, provided that they use the same Hash size and entry format: a segment
+// in use is never resized under the processes mapping it. The last process
+// to detach removes the segment, see free_table().
+const char* TranspositionTable::attach(size_t size)
+{
+#if defined(__linux__)
+	const char* name = backingFile.c_str();
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	bool create = fd != -1;
+	struct stat sb;
+
+	if (!create)
+		fd = shm_open(name, O_RDWR, 0);
+
+	if (fd == -1)
+		return nullptr;
+
+	memSize = HeaderSize + size;
+
+	if (create && ftruncate(fd, memSize))
+		return close(fd), shm_unlink(name), nullptr;
+
+	// Give the creator some time to size the segment
+	for (int i = 0; i < 100 && !fstat(fd, &sb) && !sb.st_size; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	if (fstat(fd, &sb) || size_t(sb.st_size) != memSize)
+		return close(fd), nullptr;
+
+	mem = mmap(nullptr, memSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (mem == MAP_FAILED)
+	{
+		if (create)
+			shm_unlink(name);
+
+		mem = nullptr;
+		return nullptr;
+	}
+
+	Header* h = (Header*)mem;
+
+	if (create)
+	{
+		// Publish the magic last, the other processes wait for it
+		Header ours = header();
+		std::memcpy(h->magic + 1, ours.magic + 1, sizeof(Header) - 1);
+		std::atomic_thread_fence(std::memory_order_release);
+		h->magic[0] = ours.magic[0];
+	}
+
+	for (int i = 0; i < 100 && !__atomic_load_n(&h->magic[0], __ATOMIC_ACQUIRE); ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	if (!compatible(*h) || h->clusterCount != clusterCount)
+	{
+		munmap(mem, memSize);
+		mem = nullptr;
+		return nullptr;
+	}
+
+	int processes = __atomic_add_fetch(&h->processes, 1, __ATOMIC_ACQ_REL);
+
+	mapped = shared = true;
+	table = (Cluster*)((char*)mem + HeaderSize);
+	generation8 = __atomic_load_n(&h->generation, __ATOMIC_RELAXED);
+	return processes > 1 ? "a shared memory segment, attached" : "a shared memory segment";
+#else
+	(void)size;
+	return nullptr;
+#endif
+}
+
+void TranspositionTable::free_table()
+{
+	if (!mem)
+		return;
+
+#if defined(__linux__)
+	// Detach from the segment, removing it after the last process
+	if (shared && segment)
+	{
+		if (!__atomic_sub_fetch(&((Header*)mem)->processes, 1, __ATOMIC_ACQ_REL))
+			shm_unlink(backingFile.c_str());
+	}
+
+	// Leave a valid header in the file for the next process
+	else
+#endif
+	if (shared)
+	{
+		Header h = header();
+		std::memcpy(mem, &h, sizeof(h));
+	}
+
+#if defined(__linux__)
+	if (mapped)
+		munmap(mem, memSize);
+	else
+#endif
+		free(mem);
+
+	mem = nullptr;
+	mapped = shared = false;
+}
+
+// TranspositionTable::lock() locks the table in RAM (or unlocks it), so that
+// the OS cannot swap it out in the middle of a game. Locking commits all the
+// pages at once. Only supported on Linux.
+void TranspositionTable::lock(bool on)
+{
+	locked = on;
+
+	if (!mem)
+		return;
+
+#if defined(__linux__)
+	if (on && mlock(mem, memSize))
+		sync_cout << "info string Failed to lock the transposition table in memory" << sync_endl;
+
+	else if (!on)
+		munlock(mem, memSize);
+#else
+	if (on)
+		sync_cout << "info string Locking the transposition table is not supported" << sync_endl;
+#endif
+}
+
 // TranspositionTable::resize() sets the size of the transposition table,
-// measured in megabytes. Transposition table consists of a power of 2 number
-// of clusters and each cluster consists of ClusterSize number of TTEntry.
+// measured in megabytes. Transposition table consists of as many clusters as
+// fit in the given size and each cluster consists of ClusterSize number of
+// TTEntry.
+//
+// The entries of the old table are kept: the new table is allocated first and
+// the pool threads rehash the old entries into it in parallel, then the old
+// table is freed. A file backed table is not rehashed, as the new mapping of
+// the file overwrites the old one.
 void TranspositionTable::resize(size_t mbSize)
 {
-	size_t newClusterCount = size_t(1) << msb((mbSize * 1024 * 1024) / sizeof(Cluster));
+	size_t newClusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
 
 	if (newClusterCount == clusterCount)
 		return;
 
+	if (!mem || shared)
+	{
+		reallocate(newClusterCount);
+		return;
+	}
+
+	// The copy takes over the old memory and frees it when going out of scope
+	TranspositionTable old(*this);
+
+	mem = nullptr;
+#ifdef TT_COLLISION_CHECK
+	shadow = nullptr;
+#endif
+	reallocate(newClusterCount);
+
+	source = &old;
+	Threads.rehash();
+	source = nullptr;
+
+#ifdef TT_COLLISION_CHECK
+	free(old.shadow);
+#endif
+}
+
+// TranspositionTable::set_file() sets the file backing the table, or none if
+// the name is empty, and maps the table again accordingly. When 'segment' is
+// set the name is the one of a POSIX shared memory segment, e.g. "/chameleon",
+// instead of a file name. A file and a segment exclude each other: an empty
+// name only detaches the table from the same kind of backing, and a new one is
+// refused while the other kind is set. Returns false when the name is refused
+// or cannot be mapped.
+bool TranspositionTable::set_file(const std::string& name, bool segment)
+{
+	if (backingFile.empty() ? name.empty() : this->segment != segment)
+	{
+		if (!name.empty())
+			sync_cout << "info string Clear " << (segment ? "Hash File" : "Shared Hash")
+			<< " first" << sync_endl;
+
+		return name.empty();
+	}
+
+#if !defined(__linux__)
+	if (!name.empty())
+	{
+		sync_cout << "info string File backed hash is not supported" << sync_endl;
+		return false;
+	}
+#endif
+
+#ifndef USE_WIDE_TT
+	// Only the wide entries are safe against torn writes by other processes
+	if (segment && !name.empty())
+	{
+		sync_cout << "info string Shared Hash requires a build with USE_WIDE_TT" << sync_endl;
+		return false;
+	}
+#endif
+
+	free_table(); // Detach with the old name before switching to the new one
+	backingFile = name;
+	this->segment = segment;
+	reallocate(clusterCount);
+
+	return backingFile == name;
+}
+
+// TranspositionTable::new_search() starts a new generation of entries. The
+// processes sharing a segment share its generation counter, and any of them
+// starting a search ages the entries for all of them, see sync_generation().
+void TranspositionTable::new_search()
+{
+#if defined(__linux__)
+	if (shared && segment)
+	{
+		generation8 = __atomic_add_fetch(&((Header*)mem)->generation, 4, __ATOMIC_RELAXED);
+		return;
+	}
+#endif
+
+	generation8 += 4; // Lower 2 bits are used by Bound
+}
+
+// TranspositionTable::sync_generation() is called periodically during the
+// search to pick up the generation started by another process sharing the
+// segment, so that all the writers refresh and age entries alike instead of
+// each treating the entries of the others as stale.
+void TranspositionTable::sync_generation()
+{
+#if defined(__linux__)
+	if (shared && segment)
+		generation8 = __atomic_load_n(&((Header*)mem)->generation, __ATOMIC_RELAXED);
+#endif
+}
+
+// TranspositionTable::reallocate() replaces the table with a new one of the
+// given number of clusters.
+void TranspositionTable::reallocate(size_t newClusterCount)
+{
+	free_table();
 	clusterCount = newClusterCount;
+	pages = allocate(clusterCount * sizeof(Cluster));
 
-	free(mem);
-	mem = calloc(clusterCount * sizeof(Cluster) + CacheLineSize - 1, 1);
+	if (!pages && !backingFile.empty())
+	{
+		sync_cout << "info string Failed to map " << backingFile << sync_endl;
+		backingFile.clear();
+		pages = allocate(clusterCount * sizeof(Cluster));
+	}
 
-	if (!mem)
+	if (!pages)
 	{
-		std::cerr << "Failed to allocate " << mbSize
+		std::cerr << "Failed to allocate " << (clusterCount * sizeof(Cluster) >> 20)
 			<< "MB for transposition table." << std::endl;
 		exit(EXIT_FAILURE);
 	}
 
-	table = (Cluster*)((uintptr_t(mem) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+#ifdef TT_COLLISION_CHECK
+	free(shadow);
+	shadow = (uint64_t*)calloc(clusterCount * ClusterSize, sizeof(uint64_t));
+#endif
+
+	if (locked)
+		lock(true);
+}
+
+// TranspositionTable::info() describes the size of the table and the memory
+// backing it, for the "tt stats" command. When transparent huge pages were
+// requested, it also reports how much of the table the kernel has backed
+// with them so far.
+std::string TranspositionTable::info() const
+{
+	std::string s = "Hash " + std::to_string(size_mb()) + " MB using " + pages;
+
+#if defined(__linux__)
+	if (pages == ThpRequested)
+		s += ", " + std::to_string(huge_kb(table) >> 10) + " MB backed by huge pages";
+#endif
+
+	return s;
 }
 
-// TranspositionTable::clear() overwrites the entire transposition table
-// with zeros. It is called whenever the table is resized, or when the
-// user asks the program to clear the table (from the UCI interface).
-void TranspositionTable::clear()
+// TranspositionTable::clear() overwrites with zeros the slice 'idx' of the
+// table split in 'count' slices, by default the entire table. It is called by
+// each search thread on its own slice when the user asks the program to clear
+// the table (from the UCI interface).
+void TranspositionTable::clear(size_t idx, size_t count)
 {
-	std::memset(table, 0, clusterCount * sizeof(Cluster));
+#if defined(__linux__)
+	// Don't wipe a segment under the other processes using it
+	if (shared && segment && __atomic_load_n(&((Header*)mem)->processes, __ATOMIC_RELAXED) > 1)
+		return;
+#endif
+
+	size_t begin = clusterCount * idx / count;
+	size_t end = clusterCount * (idx + 1) / count;
+
+	std::memset(&table[begin], 0, (end - begin) * sizeof(Cluster));
+
+#ifdef TT_COLLISION_CHECK
+	std::memset(&shadow[begin * ClusterSize], 0, (end - begin) * ClusterSize * sizeof(uint64_t));
+#endif
 }
 
+// TranspositionTable::rehash() fills the slice 'idx' of the table split in
+// 'count' slices with the entries of the old table that belong there. Only
+// the high bits of a key select its cluster and the entries don't store them,
+// so an old cluster is known to hold keys of a given range of new clusters
+// only, and mul_hi64() can not be computed again for an entry. Each entry is
+// stored once, in the cluster of its range picked by its stored key bits:
+// when the table grows, this is the right cluster for only a share of the
+// entries, the others are never found again and age out like any stale entry,
+// but no entry takes more than one slot. When it shrinks, the most valuable
+// entries of the old clusters merged into a new one are kept, with the same
+// depth and age criterion as the replacement strategy of probe().
+void TranspositionTable::rehash(size_t idx, size_t count)
+{
+	const TranspositionTable& old = *source;
+	size_t begin = clusterCount * idx / count;
+	size_t end = clusterCount * (idx + 1) / count;
+
+	auto value = [&](const TTEntry& tte) {
+		return tte.depth() - ((259 + generation8 - tte.gen_bound()) & 0xFC) * 2 * ONE_PLY;
+	};
+
+	for (size_t c = begin; c < end; ++c)
+	{
+		size_t first = scale(c, old.clusterCount, clusterCount, false);
+		size_t last = scale(c + 1, old.clusterCount, clusterCount, true) - 1;
+		TTEntry* tte = table[c].entry;
+
+		for (size_t oc = first; oc <= last; ++oc)
+			for (int i = 0; i < ClusterSize; ++i)
+			{
+				const TTEntry& e = old.table[oc].entry[i];
+
+				if (e.empty())
+					continue;
+
+				size_t lo = scale(oc, clusterCount, old.clusterCount, false);
+				size_t hi = scale(oc + 1, clusterCount, old.clusterCount, true);
+
+				if (lo + e.key_bits() % (hi - lo) != c)
+					continue;
+
+				TTEntry* replace = tte;
+				for (int j = 1; j < ClusterSize && !replace->empty(); ++j)
+					if (tte[j].empty() || value(tte[j]) < value(*replace))
+						replace = &tte[j];
+
+				if (replace->empty() || value(e) > value(*replace))
+				{
+					*replace = e;
+#ifdef TT_COLLISION_CHECK
+					shadow[c * ClusterSize + (replace - tte)] = old.shadow[oc * ClusterSize + i];
+#endif
+				}
+			}
+	}
+}
+
+// TranspositionTable::save() writes the header and the whole table to the
+// given file, so that the entries can be loaded back by a later session. It
+// returns false if the file could not be written.
+bool TranspositionTable::save(const std::string& fileName) const
+{
+	std::ofstream file(fileName, std::ios::binary);
+	Header h = header();
+
+	file.write((const char*)&h, sizeof(h));
+	file.write((const char*)table, clusterCount * sizeof(Cluster));
+
+	return bool(file);
+}
+
+// TranspositionTable::load() reads back a table written by save(), resizing
+// the table to the size of the saved one. Files written by a build with a
+// different entry format are refused, and so are files whose size does not
+// match the cluster count of their header, before the table is touched. It
+// returns false if the file could not be loaded; if reading the entries fails
+// the table is left empty.
+bool TranspositionTable::load(const std::string& fileName)
+{
+	std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+	std::streamoff fileSize = file.tellg();
+	Header h;
+
+	if (!file.seekg(0) || !file.read((char*)&h, sizeof(h)) || !compatible(h) || !h.clusterCount)
+		return false;
+
+	uint64_t bytes = uint64_t(fileSize) - sizeof(h);
+
+	if (bytes % sizeof(Cluster) || h.clusterCount != bytes / sizeof(Cluster))
+		return false;
+
+	if (h.clusterCount != clusterCount)
+		reallocate(h.clusterCount);
+
+	if (!file.read((char*)table, clusterCount * sizeof(Cluster)))
+	{
+		clear();
+		return false;
+	}
+
+#ifdef TT_COLLISION_CHECK
+	std::memset(shadow, 0, clusterCount * ClusterSize * sizeof(uint64_t));
+#endif
+
+	generation8 = h.generation;
+	return true;
+}
+
+#ifdef TT_COLLISION_CHECK
+// record_owner() is called by TTEntry::save() to keep aside the full key of the
+// position saved in an entry of the main table. The entries of the hot tier
+// and of the deterministic buffers are not tracked.
+void record_owner(const TTEntry* tte, uint64_t key)
+{
+	const char* p = (const char*)tte;
+	const char* begin = (const char*)TT.table;
+
+	if (p < begin || p >= begin + TT.clusterCount * sizeof(TranspositionTable::Cluster))
+		return;
+
+	size_t c = size_t(p - begin) / sizeof(TranspositionTable::Cluster);
+	TT.shadow[c * TranspositionTable::ClusterSize + (tte - &TT.table[c].entry[0])] = key;
+}
+#endif
+
 // TranspositionTable::probe() looks up the current position in the transposition
 // table. It returns true and a pointer to the TTEntry if the position is found.
 // Otherwise, it returns false and a pointer to an empty or least valuable TTEntry
-// to be replaced later. The replace value of an entry is calculated as its depth
-// minus 8 times its relative age. TTEntry t1 is considered more valuable than
-// TTEntry t2 if its replace value is greater than that of t2.
-TTEntry* TranspositionTable::probe(const uint64_t key, bool& found) const
+// to be replaced later. The entry must be read from the copy returned in 'data',
+// the one checked against the key, as the TTEntry may be written concurrently.
+// An entry found is refreshed to the current generation unless 'refresh' is
+// false, as in deterministic mode, where the TT is only read during an
+// iteration and the buffered entries are aged when flushed. The replace value
+// of an entry is calculated as its depth minus 8 times its relative age.
+// TTEntry t1 is considered more valuable than TTEntry t2 if its replace value
+// is greater than that of t2.
+TTEntry* TranspositionTable::probe(const uint64_t key, bool& found, TTEntry& data, bool refresh) const
 {
 	TTEntry* const tte = first_entry(key);
-	const uint16_t key16 = key >> 48;  // Use the high 16 bits as key inside the cluster
+
+	TT_STATS_INC(probes);
 
 	for (int i = 0; i < ClusterSize; i++)
-		if (!tte[i].key16 || tte[i].key16 == key16)
+		if ((data = tte[i].snapshot()).empty() || data.matches(key))
 		{
-			if ((tte[i].genBound8 & 0xFC) != generation8 && tte[i].key16)
-				tte[i].genBound8 = uint8_t(generation8 | tte[i].bound()); // Refresh
+			if (refresh && (data.gen_bound() & 0xFC) != generation8 && !data.empty())
+				tte[i].refresh(generation8);
 
-			return found = (bool)tte[i].key16, &tte[i];
+			found = !data.empty();
+
+			if (found)
+			{
+				TT_STATS_INC(hits);
+				TT_STATS_INC(hitsByBound[data.bound()]);
+			}
+
+#ifdef TT_COLLISION_CHECK
+			// Count the hits on entries saved by another position
+			if (found)
+				dbg_hit_on(shadow[mul_hi64(key, clusterCount) * ClusterSize + i] != key);
+#endif
+			return &tte[i];
 		}
 
 	// Find an entry to be replaced according to the replacement strategy
@@ -88,13 +768,85 @@ TTEntry* TranspositionTable::probe(const uint64_t key, bool& found) const
 		// nature we add 259 (256 is the modulus plus 3 to keep the lowest
 		// two bound bits from affecting the result) to calculate the entry
 		// age correctly even after generation8 overflows into the next cycle.
-		if (replace->depth8 - ((259 + generation8 - replace->genBound8) & 0xFC) * 2 * ONE_PLY
-	> tte[i].depth8 - ((259 + generation8 - tte[i].genBound8) & 0xFC) * 2 * ONE_PLY)
+		if (replace->depth() - ((259 + generation8 - replace->gen_bound()) & 0xFC) * 2 * ONE_PLY
+	> tte[i].depth() - ((259 + generation8 - tte[i].gen_bound()) & 0xFC) * 2 * ONE_PLY)
 			replace = &tte[i];
 
+	data = TTEntry();
+
 	return found = false, replace;
 }
 
+// TTBuffer::probe() looks up a position in the buffer of the thread and then,
+// on a miss, in the TT, copying the entry found there to the buffer. Returns
+// the entry of the buffer that holds the position from now on.
+TTEntry* TTBuffer::probe(uint64_t key, bool& found, TTEntry& data)
+{
+	if (table.empty())
+	{
+		keys.assign(Size, 0);
+		table.assign(Size, TTEntry());
+	}
+
+	size_t i = key & (Size - 1);
+	TTEntry* tte = &table[i];
+
+	if (keys[i] == key)
+		return found = !tte->empty(), data = *tte, tte;
+
+	if (!keys[i])
+		used.push_back(uint32_t(i));
+
+	else if (!tte->empty() && evicted.size() < MaxEvicted)
+	{
+		lastEvicted[keys[i]] = evicted.size();
+		evicted.emplace_back(keys[i], *tte);
+	}
+
+	keys[i] = key;
+
+	// An evicted entry is newer than the one in the TT
+	auto it = lastEvicted.find(key);
+
+	if (it != lastEvicted.end())
+		return data = *tte = evicted[it->second].second, found = true, tte;
+
+	TT.probe(key, found, data, false);
+
+	return *tte = data, tte;
+}
+
+// TTBuffer::flush() writes the buffered entries to the TT and empties the
+// buffer. Called with all the threads waiting, so the TT is not accessed
+// concurrently.
+void TTBuffer::flush()
+{
+	TTEntry unused;
+	bool found;
+
+	// The evicted entries are older than the ones still in the buffer
+	for (const auto& ke : evicted)
+		TT.probe(ke.first, found, unused)->save(ke.first, ke.second.value(), ke.second.bound(),
+			ke.second.depth(), ke.second.move(), ke.second.eval(), TT.generation());
+
+	evicted.clear();
+	lastEvicted.clear();
+
+	for (uint32_t i : used)
+	{
+		const TTEntry& e = table[i];
+
+		if (!e.empty())
+			TT.probe(keys[i], found, unused)->save(keys[i], e.value(), e.bound(), e.depth(),
+				e.move(), e.eval(), TT.generation());
+
+		keys[i] = 0;
+		table[i] = TTEntry();
+	}
+
+	used.clear();
+}
+
 // Returns an approximation of the hashtable occupation during a search. The
 // hash is x permill full, as per UCI protocol.
 int TranspositionTable::hashfull() const
@@ -105,7 +857,7 @@ int TranspositionTable::hashfull() const
 	{
 		const TTEntry* tte = &table[i].entry[0];
 		for (int j = 0; j < ClusterSize; j++)
-			if ((tte[j].genBound8 & 0xFC) == generation8)
+			if ((tte[j].gen_bound() & 0xFC) == generation8)
 				cnt++;
 	}
 	return cnt;
@@ -23,9 +23,94 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include "misc.h"
 #include "types.h"
 
+#ifdef TT_STATS
+
+// TTStats struct holds the transposition table counters of a thread. Each
+// search thread updates its own copy, with no sharing, and the counters are
+// summed only when reported. Built only with TT_STATS, otherwise the update
+// macros below expand to nothing.
+struct TTStats
+{
+	void clear() { std::memset(this, 0, sizeof(TTStats)); }
+	TTStats& operator+=(const TTStats& s);
+
+	// Write to an entry: 'empty' and 'same' describe the entry before the
+	// write, the victim fields are only used when another position is evicted.
+	void write(bool empty, bool same, uint8_t gen, uint8_t victimGenBound, int victimDepth)
+	{
+		if (empty)
+			++emptyWrites;
+		else if (same)
+			++sameKeyWrites;
+		else
+		{
+			++replaceWrites;
+			++victimsByAge[std::min(((259 + gen - victimGenBound) & 0xFC) >> 2, 3)];
+			++victimsByDepth[victimDepth <= 0 ? 0 : victimDepth <= 4 ? 1 : victimDepth <= 8 ? 2 : 3];
+		}
+	}
+
+	// Nodes searched by a child of the given depth, to estimate the nodes
+	// saved by each enhanced transposition cutoff as the average subtree size
+	// of the nodes of its depth.
+	void subtree(int d, uint64_t nodes)
+	{
+		d = std::max(0, std::min(d, 15));
+		subtreeNodes[d] += nodes;
+		++subtrees[d];
+	}
+
+	void etc_cutoff(int d)
+	{
+		d = std::max(0, std::min(d, 15));
+		++etcCutoffs;
+		etcNodesSaved += subtrees[d] ? subtreeNodes[d] / subtrees[d] : 0;
+	}
+
+	uint64_t probes, hits, hitsByBound[4], cutoffs;
+	uint64_t emptyWrites, sameKeyWrites, replaceWrites;
+	uint64_t victimsByAge[4];   // Generations since the last access: 0, 1, 2, 3+
+	uint64_t victimsByDepth[4]; // Depth: qsearch, 1-4, 5-8, 9+
+	uint64_t etcProbes, etcCutoffs, etcNodesSaved;
+	uint64_t subtreeNodes[16], subtrees[16]; // By depth in plies
+};
+
+std::ostream& operator<<(std::ostream& os, const TTStats& s);
+
+extern thread_local TTStats* ThreadTTStats;
+
+#define TT_STATS_INC(field) (++ThreadTTStats->field)
+#define TT_STATS_WRITE(...) (ThreadTTStats->write(__VA_ARGS__))
+#define TT_STATS_SUBTREE(d, nodes) (ThreadTTStats->subtree(d, nodes))
+#define TT_STATS_ETC_CUTOFF(d) (ThreadTTStats->etc_cutoff(d))
+#else
+#define TT_STATS_INC(field) ((void)0)
+#define TT_STATS_WRITE(...) ((void)0)
+#define TT_STATS_SUBTREE(d, nodes) ((void)0)
+#define TT_STATS_ETC_CUTOFF(d) ((void)0)
+#endif
+
+#ifdef TT_COLLISION_CHECK
+struct TTEntry;
+void record_owner(const TTEntry* tte, uint64_t key);
+#define TT_COLLISION_SAVE(tte, key) (record_owner(tte, key))
+#else
+#define TT_COLLISION_SAVE(tte, key) ((void)0)
+#endif
+
+#ifndef USE_WIDE_TT
+
 // TTEntry struct is the 10 bytes transposition table entry, defined as below:
 //
 // key        16 bit
@@ -45,17 +130,20 @@ struct TTEntry
 
 	void save(uint64_t k, Value v, Bound b, Depth d, Move m, Value ev, uint8_t g)
 	{
+		TT_STATS_WRITE(!key16, (uint16_t)k == key16, g, genBound8, depth8);
+		TT_COLLISION_SAVE(this, k);
+
 		// Preserve any existing move for the same position
-		if (m || (k >> 48) != key16)
+		if (m || (uint16_t)k != key16)
 			move16 = (uint16_t)m;
 
 		// Don't overwrite more valuable entries
-		if ((k >> 48) != key16
+		if ((uint16_t)k != key16
 			|| d > depth8 - 2
 			/* || g != (genBound8 & 0xFC) // Matching non-zero keys are already refreshed by probe() */
 			|| b == BOUND_EXACT)
 		{
-			key16 = (uint16_t)(k >> 48);
+			key16 = (uint16_t)k;
 			value16 = (int16_t)v;
 			eval16 = (int16_t)ev;
 			genBound8 = (uint8_t)(g | b);
@@ -65,6 +153,15 @@ struct TTEntry
 
 private:
 	friend class TranspositionTable;
+	friend struct HotTable;
+	friend struct TTBuffer;
+
+	TTEntry snapshot() const { return *this; }
+	bool empty() const { return !key16; }
+	bool matches(uint64_t k) const { return key16 == (uint16_t)k; }
+	uint32_t key_bits() const { return key16; }
+	uint8_t gen_bound() const { return genBound8; }
+	void refresh(uint8_t g) { genBound8 = uint8_t(g | bound()); }
 
 	uint16_t key16;
 	uint16_t move16;
@@ -74,8 +171,84 @@ private:
 	int8_t   depth8;
 };
 
-// A TranspositionTable consists of a power of 2 number of clusters and each
-// cluster consists of ClusterSize number of TTEntry. Each non-empty entry
+#else
+
+// TTEntry struct is the 16 bytes transposition table entry of the wide
+// format, selected with USE_WIDE_TT, defined as below:
+//
+// data       64 bit: move 16, value 16, eval value 16, generation 6,
+//                    bound type 2, depth 8
+// check      64 bit: data without generation XOR the low 32 bits of the key
+//
+// An entry matches a key only if check ^ data gives it back, so an entry torn
+// by concurrent writes from different threads reads as a miss instead of
+// mixing the data of two positions (lockless hashing, after Hyatt and Mann).
+// The 32 bits verification also makes false hits much rarer than with 16 bits.
+// The generation is left out of the check, so that refresh() is a single 64
+// bits store that a concurrent reader can not see half done.
+struct TTEntry
+{
+	static const uint64_t GenMask = 0xFCULL << 48;
+
+	Move  move()  const { return (Move)(uint16_t)data; }
+	Value value() const { return (Value)(int16_t)(data >> 16); }
+	Value eval()  const { return (Value)(int16_t)(data >> 32); }
+	Depth depth() const { return (Depth)(int8_t)(data >> 56); }
+	Bound bound() const { return (Bound)(gen_bound() & 0x3); }
+
+	void save(uint64_t k, Value v, Bound b, Depth d, Move m, Value ev, uint8_t g)
+	{
+		uint64_t old = data;
+		bool same = (check ^ (old & ~GenMask)) == (uint32_t)k;
+
+		TT_STATS_WRITE(empty(), same, g, gen_bound(), depth());
+		TT_COLLISION_SAVE(this, k);
+
+		// Preserve any existing move for the same position
+		if (!m && same)
+			m = (Move)(uint16_t)old;
+
+		// Don't overwrite more valuable entries
+		if (!same || d > (int8_t)(old >> 56) - 2 || b == BOUND_EXACT)
+			write(k, uint64_t(uint16_t(m))
+				| uint64_t(uint16_t(v)) << 16
+				| uint64_t(uint16_t(ev)) << 32
+				| uint64_t(uint8_t(g | b)) << 48
+				| uint64_t(uint8_t(d)) << 56);
+		else
+			write(k, (old & ~0xFFFFULL) | uint16_t(m));
+	}
+
+private:
+	friend class TranspositionTable;
+	friend struct HotTable;
+	friend struct TTBuffer;
+
+	// Each field is loaded exactly once, so that the copy checked by matches()
+	// is the one read afterwards, whatever other threads write meanwhile.
+	TTEntry snapshot() const
+	{
+		TTEntry e;
+		e.data = *(const volatile uint64_t*)&data;
+		e.check = *(const volatile uint64_t*)&check;
+		return e;
+	}
+
+	bool empty() const { return !data && !check; }
+	bool matches(uint64_t k) const { return (check ^ (data & ~GenMask)) == (uint32_t)k; }
+	uint32_t key_bits() const { return uint32_t(check ^ (data & ~GenMask)); }
+	uint8_t gen_bound() const { return uint8_t(data >> 48); }
+	void refresh(uint8_t g) { data = (data & ~GenMask) | uint64_t(g) << 48; }
+	void write(uint64_t k, uint64_t d) { data = d; check = uint32_t(k) ^ (d & ~GenMask); }
+
+	uint64_t data;
+	uint64_t check;
+};
+
+#endif
+
+// A TranspositionTable consists of any number of clusters and each cluster
+// consists of ClusterSize number of TTEntry. Each non-empty entry
 // contains information of exactly one position. The size of a cluster should
 // divide the size of a cache line size, to ensure that clusters never cross
 // cache lines. This ensures best cache performance, as the cacheline is
@@ -83,6 +256,8 @@ private:
 class TranspositionTable
 {
 	static const int CacheLineSize = 64;
+
+#ifndef USE_WIDE_TT
 	static const int ClusterSize = 3;
 
 	struct Cluster
@@ -90,32 +265,145 @@ class TranspositionTable
 		TTEntry entry[ClusterSize];
 		char padding[2]; // Align to a divisor of the cache line size
 	};
+#else
+	static const int ClusterSize = 4;
+
+	struct Cluster
+	{
+		TTEntry entry[ClusterSize];
+	};
+#endif
 
 	static_assert(CacheLineSize % sizeof(Cluster) == 0, "Cluster size incorrect");
 
 public:
-	~TranspositionTable() { free(mem); }
+	~TranspositionTable() { free_table(); }
 	void init() { resize(DEFAULT_HASH_MB); };
-	void new_search() { generation8 += 4; } // Lower 2 bits are used by Bound
+	void new_search();
+	void sync_generation();
 	uint8_t generation() const { return generation8; }
-	TTEntry* probe(const uint64_t key, bool& found) const;
+	TTEntry* probe(const uint64_t key, bool& found, TTEntry& data, bool refresh = true) const;
 	int hashfull() const;
 	void resize(size_t mbSize);
-	void clear();
+	bool set_file(const std::string& name, bool segment = false);
+	void lock(bool on);
+	void clear(size_t idx = 0, size_t count = 1);
+	void rehash(size_t idx, size_t count);
+	bool save(const std::string& fileName) const;
+	bool load(const std::string& fileName);
+	std::string info() const;
+	size_t size_mb() const { return clusterCount * sizeof(Cluster) >> 20; }
 
-	// The lowest order bits of the key are used to get the index of the cluster
+	// The high half of key * clusterCount is used to get the index of the
+	// cluster, so that it depends mostly on the highest order bits of the key.
 	TTEntry* first_entry(const uint64_t key) const
 	{
-		return &table[(size_t)key & (clusterCount - 1)].entry[0];
+		return &table[mul_hi64(key, clusterCount)].entry[0];
 	}
 
 private:
+	// Header of TT snapshot files and of file backed tables. The entries of a
+	// file are used only if they were written with the same entry format.
+	struct Header
+	{
+		char magic[8];
+		uint32_t entrySize;
+		uint32_t clusterSize;
+		uint32_t clusterBytes;
+		uint32_t keyBits;
+		uint64_t clusterCount;
+		uint8_t generation;
+		uint32_t processes; // Attached to a shared memory segment
+	};
+
+	Header header() const;
+	bool compatible(const Header& h) const;
+	void reallocate(size_t newClusterCount);
+	const char* allocate(size_t size);
+	const char* attach(size_t size);
+	void free_table();
+
 	size_t clusterCount;
 	Cluster* table;
 	void* mem;
+	size_t memSize;
+#ifdef TT_COLLISION_CHECK
+	friend void record_owner(const TTEntry* tte, uint64_t key);
+	uint64_t* shadow; // Full key of the position owning each entry
+#endif
+	std::string backingFile;
+	const char* pages; // Kind of memory backing the table
+	const TranspositionTable* source; // Old table while resize() rehashes it
+	bool mapped;
+	bool shared;  // Mapping of a file, starting with a Header
+	bool segment; // The file is a POSIX shared memory segment
+	bool locked;
 	uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
 };
 
 extern TranspositionTable TT;
 
+// HotTable is the small tier of the two-tier transposition table, enabled by
+// the "Hot Hash" option. Each thread has its own, sized to stay in the L2
+// cache, to hold the entries of qsearch and of the nodes at depth ONE_PLY:
+// they are many and short lived, and in the main table they would evict the
+// deeper entries sharing their cluster. It is direct mapped and always
+// replaces, the slot being selected by the high bits of the key, as in the
+// main table.
+struct HotTable
+{
+	static const int Size = 1 << 16;
+
+	TTEntry* entry(uint64_t key) { return &table[key >> 48]; }
+
+	TTEntry* probe(uint64_t key, bool& found, TTEntry& data)
+	{
+		TTEntry* tte = entry(key);
+
+		TT_STATS_INC(probes);
+		found = !tte->empty() && tte->matches(key);
+		data = *tte;
+
+		if (found)
+		{
+			TT_STATS_INC(hits);
+			TT_STATS_INC(hitsByBound[tte->bound()]);
+		}
+
+		return tte;
+	}
+
+	void clear() { std::memset(table, 0, sizeof(table)); }
+
+private:
+	TTEntry table[Size];
+};
+
+// TTBuffer holds the TT entries written by a thread in the deterministic mode
+// enabled with the "Deterministic" option, where the TT is only read during an
+// iteration. The buffered entries are written to the TT when the threads meet
+// at the end of the iteration, in thread order, see ThreadPool::sync(). An
+// entry found only in the TT is first copied to the buffer, so that it can be
+// updated. The buffer is direct mapped: an entry replaced by another position
+// is moved to an overflow list, flushed first, and looked up there before the
+// TT when the position is probed again. The list is capped, so that memory does
+// not grow with the nodes of an iteration: once full, replaced entries are
+// dropped, which depends only on the searches of the thread and so keeps the
+// mode deterministic.
+struct TTBuffer
+{
+	static const int Size = 1 << 18;
+	static const size_t MaxEvicted = Size;
+
+	TTEntry* probe(uint64_t key, bool& found, TTEntry& data);
+	void flush();
+
+private:
+	std::vector<uint64_t> keys; // Full key of each entry, 0 when free
+	std::vector<TTEntry> table;
+	std::vector<uint32_t> used; // Slots to flush
+	std::vector<std::pair<uint64_t, TTEntry>> evicted; // Replaced entries, in order
+	std::unordered_map<uint64_t, size_t> lastEvicted;  // Latest index of a key in evicted
+};
+
 #endif // #ifndef TT_H_INCLUDED
\ No newline at end of file
@@ -39,6 +39,21 @@
 //
 // -DUSE_PEXT    | Add runtime support for use of pext asm-instruction. Works
 //               | only in 64-bit mode and requires hardware with pext support.
+//
+// -DUSE_COPY_MAKE | Search by copying the position at each ply instead of
+//                 | undoing moves. Faster or slower depending on the CPU.
+//
+// -DUSE_WIDE_TT | Use 16 bytes transposition table entries, 4 per cache line,
+//               | with 32 bits lockless verification instead of 10 bytes ones.
+//
+// -DTT_COLLISION_CHECK | Keep the full key of each TT entry aside and report
+//                      | the rate of false hits with dbg_print().
+//
+// -DUSE_PREFETCH_AHEAD | Also prefetch the entries of the next move of the
+//                      | move picker while the current one is searched.
+//
+// -DTT_STATS    | Count TT probes, hits, cutoffs and writes per thread, shown
+//               | by the "tt stats" command and the "TT Stats" option.
 
 #include <cassert>
 #include <cctype>
@@ -536,6 +551,11 @@ inline bool is_ok(Move m)
 {
 	return from_sq(m) != to_sq(m); // Catch MOVE_NULL and MOVE_NONE
 }
+
+inline Move mirror(Move m)
+{
+	return m == MOVE_NONE ? m : make_move(mirror(from_sq(m)), mirror(to_sq(m)));
+}
 inline char file_to_char(File f, bool tolower = true)
 {
 	return char(f - FILE_A + (tolower ? 'a' : 'A'));
@@ -20,12 +20,17 @@
   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
+#include "epd.h"
 #include "evaluate.h"
 #include "movegen.h"
+#include "numa.h"
+#include "packed.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -34,13 +39,20 @@
 
 using namespace std;
 
+extern void benchmark(const Position& pos, istream& is);
+extern void codec_benchmark(istream& is);
+extern void scaling_benchmark(istream& is);
+
 // FEN string of the initial position, normal chess
 const char* StartFEN = "rnbakabnr/9/1c5c1/p1p1p1p1p/9/9/P1P1P1P1P/1C5C1/9/RNBAKABNR w - - 0 1";
 
-// Stack to keep track of the position states along the setup moves (from the
-// start position to the position just before the search starts). Needed by
-// 'draw by repetition' detection.
-Search::StateStackPtr SetupStates;
+// FEN string and move list of the last "position" command, together with the
+// key of the position they led to. GUIs resend the whole game before every
+// move, so when a new command extends the previous one only the new moves
+// have to be played. Their states are kept in Search::SetupStates.
+string SetupFen;
+vector<string> SetupMoves;
+uint64_t SetupKey;
 
 // position() is called when engine receives the "position" UCI command.
 // The function sets up the position described in the given FEN string ("fen")
@@ -50,6 +62,8 @@ void position(Position& pos, istringstream& is)
 {
 	Move m;
 	string token, fen;
+	vector<string> moves;
+	size_t played = 0;
 
 	is >> token;
 
@@ -74,15 +88,39 @@ void position(Position& pos, istringstream& is)
 		}
 	}
 
-	pos.set(fen, false, Threads.main());
-	SetupStates = Search::StateStackPtr(new std::stack<StateInfo>);
+	while (is >> token)
+		moves.push_back(token);
+
+	// The root position of a running search links to the old states, and the
+	// setup moves below would update the node counter of the main thread.
+	Threads.main()->wait_for_search_finished();
+
+	// Keep the current position if the new move list extends the one already
+	// played on it, otherwise set up the position from scratch.
+	if (fen == SetupFen
+		&& pos.key() == SetupKey
+		&& moves.size() >= SetupMoves.size()
+		&& std::equal(SetupMoves.begin(), SetupMoves.end(), moves.begin()))
+		played = SetupMoves.size();
+	else
+	{
+		pos.set(fen, false, Threads.main());
+		Search::SetupStates.clear();
+		SetupMoves.clear();
+		SetupFen = fen;
+	}
 
-	// Parse move list (if any)
-	while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
+	// Parse the new part of the move list (if any)
+	for (size_t i = played; i < moves.size(); ++i)
 	{
-		SetupStates->push(StateInfo());
-		pos.do_move(m, SetupStates->top(), pos.gives_check(m, CheckInfo(pos)));
+		if ((m = UCI::to_move(pos, moves[i])) == MOVE_NONE)
+			break;
+
+		pos.do_move(m, Search::SetupStates.push(), pos.gives_check(m, CheckInfo(pos)));
+		SetupMoves.push_back(moves[i]);
 	}
+
+	SetupKey = pos.key();
 }
 
 // setoption() is called when engine receives the "setoption" UCI command. The
@@ -134,7 +172,89 @@ void go(const Position& pos, istringstream& is)
 		else if (token == "infinite")  limits.infinite = 1;
 		else if (token == "ponder")    limits.ponder = 1;
 
-		Threads.start_thinking(pos, limits, SetupStates);
+		Threads.start_thinking(pos, limits);
+}
+
+// tt() is called when engine receives the "tt" command, followed by one of
+// the transposition table subcommands: "stats" prints the size and the pages
+// of the table and the NUMA topology, then the TT counters of all the threads
+// (builds with TT_STATS only), "save <file>" writes the table to a file and
+// "load <file>" reads it back, e.g. to resume an analysis.
+void tt(istringstream& is)
+{
+	string token, fileName;
+
+	is >> token >> fileName;
+
+	if (token == "save" || token == "load")
+	{
+		Threads.main()->wait_for_search_finished();
+
+		bool save = token == "save";
+		bool ok = save ? TT.save(fileName) : TT.load(fileName);
+
+		sync_cout << "info string " << (ok ? "Hash " : "Failed to ")
+			<< (ok ? (save ? "saved to " : "loaded from ") : (save ? "save hash to " : "load hash from "))
+			<< fileName << sync_endl;
+
+		// The table now has the size of the file, report it through the option
+		if (ok && !save)
+			Options["Hash"] = std::to_string(TT.size_mb());
+	}
+
+	else if (token == "stats")
+	{
+		sync_cout << "info string " << TT.info() << sync_endl;
+		sync_cout << "info string " << Numa::info() << sync_endl;
+#ifdef TT_STATS
+		sync_cout << "info string " << Threads.tt_stats() << sync_endl;
+#else
+		sync_cout << "info string TT statistics not compiled in, build with TT_STATS" << sync_endl;
+#endif
+	}
+
+	else
+		sync_cout << "Unknown tt command: " << token << sync_endl;
+}
+
+// latency() is called when engine receives the "latency" command. It prints
+// the histogram of the time taken to send the best move once the search is
+// stopped, or clears it when followed by "clear".
+void latency(istringstream& is)
+{
+	string token;
+
+	if (is >> token && token == "clear")
+		Search::StopLatencies.clear();
+	else
+		sync_cout << "info string " << Search::StopLatencies << sync_endl;
+}
+
+// pack() is called when engine receives the "pack" command. The function
+// converts a FEN or EPD file into a file of packed positions, as read back
+// by PackedReader.
+void pack(istringstream& is)
+{
+	string fenFile, packedFile;
+	EpdRecord rec;
+
+	is >> fenFile >> packedFile;
+
+	EpdReader in(fenFile);
+	PackedWriter out(packedFile);
+
+	if (!in.is_open() || !out.is_open())
+	{
+		sync_cout << "Unable to open " << fenFile << " or " << packedFile << sync_endl;
+		return;
+	}
+
+	size_t cnt = 0;
+
+	for (; in.next(rec); ++cnt)
+		out.write(rec.packed);
+
+	sync_cout << "Packed " << cnt << " positions" << sync_endl;
 }
 
 // UCI::loop() waits for a command from stdin, parses it and calls the appropriate
@@ -170,7 +290,7 @@ void UCI::loop(int argc, char* argv[])
 			|| token == "stop"
 			|| (token == "ponderhit" && Search::Signals.stopOnPonderhit))
 		{
-			Search::Signals.stop = true;
+			Search::request_stop();
 			Threads.main()->start_searching(true); // Could be sleeping
 		}
 		else if (token == "ponderhit")
@@ -193,6 +313,23 @@ void UCI::loop(int argc, char* argv[])
 
 		// Additional custom non-UCI commands, useful for debugging
 		else if (token == "flip")       pos.flip();
+		else if (token == "bench")      benchmark(pos, is);
+		else if (token == "codecbench") codec_benchmark(is);
+		else if (token == "scaling")    scaling_benchmark(is);
+		else if (token == "pack")       pack(is);
+		else if (token == "tt")         tt(is);
+		else if (token == "latency")    latency(is);
+		else if (token == "perft")
+		{
+			int depth;
+			stringstream ss;
+
+			is >> depth;
+			ss << Options["Hash"] << " "
+				<< Options["Threads"] << " " << depth << " current perft";
+
+			benchmark(pos, ss);
+		}
 		else if (token == "d")          sync_cout << pos << sync_endl;
 		else
 			sync_cout << "Unknown command: " << cmd << sync_endl;
@@ -22,9 +22,11 @@
 
 #include <algorithm>
 #include <cassert>
+#include <iostream>
 #include <ostream>
 
 #include "misc.h"
+#include "numa.h"
 #include "search.h"
 #include "thread.h"
 #include "tt.h"
@@ -38,8 +40,30 @@ namespace UCI
 {
 	// 'On change' actions, triggered by an option's value change
 	void on_clear_hash(const Option&) { Search::clear(); }
-	void on_hash_size(const Option& o) { TT.resize(o); }
-	void on_threads(const Option&) { Threads.read_uci_options(); }
+	void on_hash_size(const Option& o)
+	{
+		TT.resize(o);
+		sync_cout << "info string " << Numa::info() << sync_endl;
+	}
+
+	void on_lock_hash(const Option& o) { TT.lock(o); }
+	void on_hash_file(const Option& o)
+	{
+		if (!TT.set_file(string(o) == "<empty>" ? "" : string(o)))
+			Options["Hash File"] = string("<empty>");
+	}
+
+	void on_shared_hash(const Option& o)
+	{
+		if (!TT.set_file(string(o) == "<empty>" ? "" : string(o), true))
+			Options["Shared Hash"] = string("<empty>");
+	}
+
+	void on_threads(const Option&)
+	{
+		Threads.read_uci_options();
+		sync_cout << "info string " << Numa::info() << sync_endl;
+	}
 
 	// Our case insensitive less() function as required by UCI protocol
 	bool CaseInsensitiveLess::operator() (const string& s1, const string& s2) const
@@ -55,6 +79,18 @@ namespace UCI
 		Options["Threads"] << Option(DEFAULT_THREAD_COUNT, MIN_THREAD_COUNT, MAX_THREAD_COUNT, on_threads);
 		Options["Hash"] << Option(DEFAULT_HASH_MB, MIN_HASH_MB, MAX_HASH_MB, on_hash_size);
 		Options["Clear Hash"] << Option(on_clear_hash);
+		Options["Mirror Hash"] << Option(false);
+		Options["Hot Hash"] << Option(false);
+		Options["ETC"] << Option(false);
+		Options["ABDADA"] << Option(false);
+		Options["YBWC"] << Option(false);
+		Options["Deterministic"] << Option(false);
+		Options["Lock Hash"] << Option(false, on_lock_hash);
+		Options["Hash File"] << Option("<empty>", on_hash_file);
+		Options["Shared Hash"] << Option("<empty>", on_shared_hash);
+#ifdef TT_STATS
+		Options["TT Stats"] << Option(false);
+#endif
 		Options["Ponder"] << Option(false);
 		Options["MultiPV"] << Option(1, 1, 500);
 		Options["Move Overhead"] << Option(20, 0, 5000);